@@ -50,40 +50,54 @@ extern const char *const classes_names[MAX_CLASS];
 extern const char *const uarch_names[MAX_ARCH];
 
 /*
- * Declare global variables
+ * Everything that depends on the package being studied: its
+ * micro-architecture, its slices and how to program its CBos. Packages of a
+ * multi-socket machine are studied independently, each with its own context.
  */
-// FIXME most of these should probably not be globals
-extern uarch_t archi;
-extern class_t class; // xeon or core
-extern int nb_cores;
-extern int max_slices;
+typedef struct {
+    int package;
+    int cpu; // CPU of the package driving its uncore
+    uarch_t archi;
+    class_t class; // xeon or core
+    int nb_cores;
+    int max_slices;
+    int counter_width; // width in bits of the CBo counters
 
-// FIXME This should probably be turned into a mix of structs and unions
-// Or Re-written in rust.
+    // Xeon and Core processors have rather different performance counters.
 
-// Xeon and Core processors have rather different performance counters.
+    // Xeons MSRs and values
+    unsigned long long msr_pmon_ctr0[24];
+    unsigned long long msr_pmon_box_filter[24];
+    unsigned long long msr_pmon_ctl0[24];
+    unsigned long long msr_pmon_box_ctl[24];
+    unsigned long long val_box_freeze;
+    unsigned long long val_box_reset;
+    unsigned long long val_box_reset_ctrs; // counters only, keeps controls
+    unsigned long long val_enable_counting;
+    unsigned long long val_select_event;
+    unsigned long long val_filter;
+    unsigned long long val_box_unfreeze;
 
-// Xeons MSRs and values
-extern unsigned long long msr_pmon_ctr0[24];
-extern unsigned long long msr_pmon_box_filter[24];
-extern unsigned long long msr_pmon_ctl0[24];
-extern unsigned long long msr_pmon_box_ctl[24];
-extern unsigned long long val_box_freeze;
-extern unsigned long long val_box_reset;
-extern unsigned long long val_enable_counting;
-extern unsigned long long val_select_event;
-extern unsigned long long val_filter;
-extern unsigned long long val_box_unfreeze;
+    // Core MSRs and values
+    unsigned long long msr_unc_perf_global_ctr;
+    unsigned long long msr_unc_cbo_perfevtsel0[8];
+    unsigned long long msr_unc_cbo_per_ctr0[8];
+    unsigned long long val_enable_ctrs;
+    unsigned long long val_disable_ctrs;
+    unsigned long long val_select_evt_core;
+    unsigned long long val_reset_ctrs;
+} socket_ctx_t;
 
-// Core MSRs and values
-extern unsigned long long msr_unc_perf_global_ctr;
-extern unsigned long long msr_unc_cbo_perfevtsel0[8];
-extern unsigned long long msr_unc_cbo_per_ctr0[8];
-extern unsigned long long val_enable_ctrs;
-extern unsigned long long val_disable_ctrs;
-extern unsigned long long val_select_evt_core;
-extern unsigned long long val_reset_ctrs;
+// Context of the package this process studies
+extern socket_ctx_t *socket_ctx;
 
-int determine_class_uarch(int cpu_model);
-int setup_perf_counters(class_t class, uarch_t archi, int nb_cores);
+/*
+ * Fill a context for the package of a CPU. Returns 0, -ENXIO if the CPU has
+ * no package (offline or out of range), or -ENOTSUP if the micro-architecture
+ * is unknown, in which case only the topology fields (package, cpu, nb_cores)
+ * and the class/uarch found so far are valid.
+ */
+int socket_ctx_init(socket_ctx_t *ctx, int cpu);
+int determine_class_uarch(socket_ctx_t *ctx, int cpu_model);
+int setup_perf_counters(socket_ctx_t *ctx);
 #endif // SLICE_REVERSE_ARCH_H
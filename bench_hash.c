@@ -0,0 +1,158 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "model.h"
+#include "slice_hash.h"
+#include "util.h"
+
+/*
+ * Throughput of slice_hash_batch() with each kernel the CPU supports, on
+ * random line addresses
+ */
+
+#define DEFAULT_ADDRESSES (1 << 24)
+#define DEFAULT_ROUNDS 5
+#define ADDRESS_BITS 46
+
+static const char *const kernel_names[] = {"scalar", "avx2", "avx512"};
+
+void print_help() {
+    fprintf(stderr,
+            "  >> Usage: ./bench_hash [-m model] [-c cores] [-n addresses] [-r rounds]\n");
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    char *model_file = NULL;
+    int nb_cores = 4, rounds = DEFAULT_ROUNDS;
+    size_t n = DEFAULT_ADDRESSES, i;
+    uint64_t x = 88172645463325252ULL;
+    uint64_t *paddrs;
+    uint8_t *out, *ref;
+    model_t model;
+    slice_hash_t hash;
+    struct timespec start;
+    double t, best;
+    unsigned int k;
+    int opt, r, ret;
+
+    while ((opt = getopt(argc, argv, "hm:c:n:r:")) != -1) {
+        switch (opt) {
+        case 'm':
+            model_file = optarg;
+            break;
+        case 'c':
+            nb_cores = atoi(optarg);
+            break;
+        case 'n':
+            n = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            print_help();
+            exit(1);
+        }
+    }
+    if (n == 0 || rounds < 1) {
+        print_help();
+        exit(1);
+    }
+
+    if (model_file != NULL) {
+        ret = model_load(&model, model_file);
+    } else {
+        ret = cache_slice_model(&model, nb_cores);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Cannot build the slice function: %s\n",
+                strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+    ret = slice_hash_init(&hash, model.masks, model.nb_bits, model.table);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot compile the slice function: %s\n",
+                strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    paddrs = (uint64_t *)malloc(n * sizeof(uint64_t));
+    out = (uint8_t *)malloc(n);
+    ref = (uint8_t *)malloc(n);
+    if (paddrs == NULL || out == NULL || ref == NULL) {
+        fprintf(stderr, "Cannot allocate %zu addresses\n", n);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        paddrs[i] = x & (((1ULL << ADDRESS_BITS) - 1) & ~63ULL);
+    }
+
+    printf("%zu addresses, %d pre-hash bits, %s\n", n, hash.nb_bits,
+           hash.table == NULL ? "linear" : "non-linear");
+
+    slice_hash_set_kernel("scalar");
+    slice_hash_batch(&hash, paddrs, n, ref);
+
+    for (k = 0; k < sizeof(kernel_names) / sizeof(kernel_names[0]); k++) {
+        if (slice_hash_set_kernel(kernel_names[k]) < 0) {
+            printf("%-8s not supported\n", kernel_names[k]);
+            continue;
+        }
+        best = 0;
+        for (r = 0; r < rounds; r++) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            slice_hash_batch(&hash, paddrs, n, out);
+            t = elapsed(&start);
+            if (best == 0 || t < best) {
+                best = t;
+            }
+        }
+        printf("%-8s %10.1f M addresses/s %8.2f GB/s%s\n", kernel_names[k],
+               n / best / 1e6, n * sizeof(uint64_t) / best / 1e9,
+               memcmp(out, ref, n) ? "  MISMATCH" : "");
+    }
+
+    slice_hash_free(&hash);
+    model_free(&model);
+    free(paddrs);
+    free(out);
+    free(ref);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+int checkpoint_save(const char *path, const checkpoint_t *cp) {
+    char tmp[4096];
+    int fd, err;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return -ENAMETOOLONG;
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -errno;
+    }
+    errno = 0;
+    if (write(fd, cp, sizeof(*cp)) != sizeof(*cp)) {
+        err = errno ? -errno : -EIO;
+        close(fd);
+        unlink(tmp);
+        return err;
+    }
+    if (close(fd) < 0 || rename(tmp, path) < 0) {
+        err = -errno;
+        unlink(tmp);
+        return err;
+    }
+
+    return 0;
+}
+
+int checkpoint_load(const char *path, checkpoint_t *cp) {
+    ssize_t size;
+    int err, fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -errno;
+    }
+    size = read(fd, cp, sizeof(*cp));
+    if (size < 0) {
+        err = -errno;
+        close(fd);
+        return err;
+    }
+    close(fd);
+
+    if (size != sizeof(*cp) || cp->magic != CHECKPOINT_MAGIC ||
+        cp->version != CHECKPOINT_VERSION) {
+        memset(cp, 0, sizeof(*cp));
+        return -EINVAL;
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#ifndef SLICE_REVERSE_CHECKPOINT_H
+#define SLICE_REVERSE_CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "decode.h"
+
+#define CHECKPOINT_MAGIC 0x43494c53 // "SLIC"
+#define CHECKPOINT_VERSION 1
+
+/*
+ * State of a reverse run, enough to continue it after an interruption: the
+ * evidence gathered for every address bit and which bits are over. The pairs
+ * probed for a bit are planned from its number of samples, so the evidence is
+ * also the position in the probe plan.
+ *
+ * The file is the raw structure: it is only meant to be read back on the
+ * machine that wrote it, which the CPU signature and slice count check.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t signature;      // CPUID.1:EAX, family, model and stepping
+    int32_t nb_slices;
+    int32_t method;          // reverse function the run belongs to
+    int32_t next_bit;        // lowest bit not over yet
+    uint64_t done;           // bits whose sampling is over
+    int64_t nb_pairs;        // pairs probed so far
+    bit_evidence_t ev[64];
+} checkpoint_t;
+
+/*
+ * Both return 0 on success and a negative errno value on failure, -EINVAL
+ * for a file that is not a checkpoint of this version. A checkpoint is written
+ * next to the file and renamed over it, so an interruption while saving
+ * leaves the previous one intact.
+ */
+int checkpoint_save(const char *path, const checkpoint_t *cp);
+int checkpoint_load(const char *path, checkpoint_t *cp);
+
+#endif // SLICE_REVERSE_CHECKPOINT_H
@@ -0,0 +1,85 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <math.h>
+#include <stddef.h>
+
+#include "decode.h"
+
+static double decode_llr = 9.21; // ln((1 - DECODE_ERROR) / DECODE_ERROR)
+
+void decode_set_error(double error) {
+    decode_llr = log((1 - error) / error);
+}
+
+/*
+ * Fraction of samples that disagree with the majority of their bit
+ */
+double decode_noise(const bit_evidence_t *ev, int nb_bits, int nb_outputs) {
+    long minority = 0, total = 0;
+    int i, k, f;
+    double noise;
+
+    for (i = 0; i < nb_bits; i++) {
+        for (k = 0; k < nb_outputs; k++) {
+            f = ev[i].flips[k];
+            minority += f < ev[i].samples - f ? f : ev[i].samples - f;
+            total += ev[i].samples;
+        }
+    }
+    noise = total ? (double)minority / total : 0;
+    if (noise < DECODE_MIN_NOISE) {
+        noise = DECODE_MIN_NOISE;
+    }
+    if (noise > DECODE_MAX_NOISE) {
+        noise = DECODE_MAX_NOISE;
+    }
+    return noise;
+}
+
+/*
+ * Each flip weighs ln((1 - noise) / noise) towards "in", each non-flip as much
+ * towards "out". The confidence is the posterior of the chosen hypothesis.
+ */
+int decode_bit(int flips, int samples, double noise, double *confidence) {
+    double llr = (2 * flips - samples) * log((1 - noise) / noise);
+
+    if (confidence != NULL) {
+        *confidence = 1 / (1 + exp(-fabs(llr)));
+    }
+    if (samples == 0 || fabs(llr) < decode_llr) {
+        return DECODE_AMBIGUOUS;
+    }
+    return llr > 0 ? DECODE_IN : DECODE_OUT;
+}
+
+int decode_ambiguous(const bit_evidence_t *ev, int nb_outputs, double noise) {
+    int k;
+
+    for (k = 0; k < nb_outputs; k++) {
+        if (decode_bit(ev->flips[k], ev->samples, noise, NULL) ==
+            DECODE_AMBIGUOUS) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_DECODE_H
+#define SLICE_REVERSE_DECODE_H
+
+/*
+ * Decision on whether an address bit is part of an output bit of the hash.
+ *
+ * Each sample of an address bit is a pair of addresses differing only in
+ * that bit: the output bit flips for every pair if the address bit is in its
+ * XOR, and never otherwise. Probing errors flip it at random with a small rate
+ * (the noise), estimated over all the samples. A bit is decided once the
+ * log-likelihood ratio between both hypotheses reaches ln((1 - e) / e), with
+ * e the accepted chance of being wrong, and is ambiguous until then.
+ */
+
+#define DECODE_MAX_OUTPUTS 8
+
+#define DECODE_MIN_NOISE 0.01 // floor of the noise estimate
+#define DECODE_MAX_NOISE 0.25
+#define DECODE_ERROR 1e-4     // default chance for a decided bit to be wrong
+
+#define DECODE_OUT 0
+#define DECODE_IN 1
+#define DECODE_AMBIGUOUS -1
+
+typedef struct {
+    int samples;                     // pairs probed
+    int flips[DECODE_MAX_OUTPUTS];   // pairs whose output bit k differed
+} bit_evidence_t;
+
+void decode_set_error(double error);
+double decode_noise(const bit_evidence_t *ev, int nb_bits, int nb_outputs);
+int decode_bit(int flips, int samples, double noise, double *confidence);
+int decode_ambiguous(const bit_evidence_t *ev, int nb_outputs, double noise);
+
+#endif // SLICE_REVERSE_DECODE_H
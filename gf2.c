@@ -0,0 +1,81 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "gf2.h"
+
+void gf2_init(gf2_t *sys) {
+    memset(sys, 0, sizeof(*sys));
+}
+
+/*
+ * Reduce the row by the pivots already in the system, and keep it if
+ * something is left
+ */
+int gf2_add(gf2_t *sys, uint64_t a, uint64_t b) {
+    int p;
+
+    while (a != 0) {
+        p = 63 - __builtin_clzll(a);
+        if (!(sys->pivots >> p & 1)) {
+            sys->a[p] = a;
+            sys->b[p] = b;
+            sys->pivots |= 1ULL << p;
+            return GF2_NEW;
+        }
+        a ^= sys->a[p];
+        b ^= sys->b[p];
+    }
+
+    return b == 0 ? GF2_REDUNDANT : GF2_INCONSISTENT;
+}
+
+int gf2_rank(const gf2_t *sys) {
+    return __builtin_popcountll(sys->pivots);
+}
+
+/*
+ * masks[k] is a solution of a.x = bit k of b for every row. Unknowns without
+ * pivot are free and set to 0.
+ */
+void gf2_solve(const gf2_t *sys, uint64_t *masks, int nb_rhs) {
+    uint64_t rest;
+    int p, k;
+
+    for (k = 0; k < nb_rhs; k++) {
+        masks[k] = 0;
+    }
+    // Row p only involves unknowns below p: solve from the lowest pivot up
+    for (p = 0; p < 64; p++) {
+        if (!(sys->pivots >> p & 1)) {
+            continue;
+        }
+        rest = sys->a[p] & ~(1ULL << p);
+        for (k = 0; k < nb_rhs; k++) {
+            if (((sys->b[p] >> k) ^ __builtin_parityll(rest & masks[k])) & 1) {
+                masks[k] |= 1ULL << p;
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_GF2_H
+#define SLICE_REVERSE_GF2_H
+
+#include <stdint.h>
+
+/*
+ * Linear system over GF(2) with 64 unknowns, one per bit of a row, and up to
+ * 64 right-hand sides solved at once (one per bit of b).
+ *
+ * Rows are eliminated as they are added: the system only keeps one row per
+ * pivot, the highest set bit of the reduced row, so it never holds more than
+ * 64 rows whatever the number of samples.
+ */
+typedef struct {
+    uint64_t a[64];   // a[p] has p as highest bit, valid if pivots has bit p
+    uint64_t b[64];
+    uint64_t pivots;
+} gf2_t;
+
+#define GF2_NEW 1           // the row increased the rank
+#define GF2_REDUNDANT 0     // the row follows from the previous ones
+#define GF2_INCONSISTENT -1 // the row contradicts the previous ones
+
+void gf2_init(gf2_t *sys);
+int gf2_add(gf2_t *sys, uint64_t a, uint64_t b);
+int gf2_rank(const gf2_t *sys);
+void gf2_solve(const gf2_t *sys, uint64_t *masks, int nb_rhs);
+
+#endif // SLICE_REVERSE_GF2_H
@@ -0,0 +1,238 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hugepool.h"
+#include "translate.h"
+
+static size_t frame_hash(uint64_t frame, size_t size) {
+    // Fibonacci hashing: consecutive frames spread over the table
+    return (frame * 0x9E3779B97F4A7C15ULL) >> 32 & (size - 1);
+}
+
+static size_t find_slot(const hugepool_t *pool, uint64_t frame) {
+    size_t i = frame_hash(frame, pool->size);
+
+    while (pool->slots[i] >= 0 && pool->frames[pool->slots[i]] != frame) {
+        i = (i + 1) & (pool->size - 1);
+    }
+    return i;
+}
+
+int hugepool_init(hugepool_t *pool, char *mem, int nb_pages, int page_shift) {
+    size_t i;
+    int page;
+
+    pool->mem = mem;
+    pool->nb_pages = nb_pages;
+    pool->page_shift = page_shift;
+    pool->pairs_size = 0;
+    pool->pairs = NULL;
+    pool->size = 1;
+    while (pool->size < 2 * (size_t)nb_pages) {
+        pool->size <<= 1;
+    }
+    pool->frames = (uint64_t *)malloc(nb_pages * sizeof(uint64_t));
+    pool->slots = (int *)malloc(pool->size * sizeof(int));
+    if (pool->frames == NULL || pool->slots == NULL) {
+        hugepool_free(pool);
+        return -ENOMEM;
+    }
+    for (i = 0; i < pool->size; i++) {
+        pool->slots[i] = -1;
+    }
+
+    for (page = 0; page < nb_pages; page++) {
+        pool->frames[page] = translate(hugepool_page(pool, page)) >> page_shift;
+        if (pool->frames[page] != 0) {
+            pool->slots[find_slot(pool, pool->frames[page])] = page;
+        }
+    }
+
+    return 0;
+}
+
+void hugepool_free(hugepool_t *pool) {
+    free(pool->frames);
+    free(pool->slots);
+    free(pool->pairs);
+    pool->frames = NULL;
+    pool->slots = NULL;
+    pool->pairs = NULL;
+    pool->nb_pages = 0;
+    pool->size = 0;
+    pool->pairs_size = 0;
+}
+
+int hugepool_find(const hugepool_t *pool, uint64_t frame) {
+    if (frame == 0 || pool->slots == NULL) {
+        return -1;
+    }
+    return pool->slots[find_slot(pool, frame)];
+}
+
+int hugepool_index_pairs(hugepool_t *pool) {
+    size_t i, nb_pairs;
+    uint64_t xor;
+    int a, b;
+
+    if (pool->pairs != NULL) {
+        return 0;
+    }
+    if (pool->nb_pages > HUGEPOOL_MAX_PAIRED) {
+        return -E2BIG;
+    }
+    nb_pairs = (size_t)pool->nb_pages * (pool->nb_pages - 1) / 2;
+    pool->pairs_size = 1;
+    while (pool->pairs_size < 2 * nb_pairs) {
+        pool->pairs_size <<= 1;
+    }
+    pool->pairs =
+        (hugepool_pair_t *)calloc(pool->pairs_size, sizeof(hugepool_pair_t));
+    if (pool->pairs == NULL) {
+        pool->pairs_size = 0;
+        return -ENOMEM;
+    }
+
+    // Several pairs may share a XOR: they follow each other in the probe run
+    for (a = 0; a < pool->nb_pages; a++) {
+        if (pool->frames[a] == 0) {
+            continue;
+        }
+        for (b = a + 1; b < pool->nb_pages; b++) {
+            if (pool->frames[b] == 0) {
+                continue;
+            }
+            xor = pool->frames[a] ^ pool->frames[b];
+            i = frame_hash(xor, pool->pairs_size);
+            while (pool->pairs[i].xor != 0) {
+                i = (i + 1) & (pool->pairs_size - 1);
+            }
+            pool->pairs[i].xor = xor;
+            pool->pairs[i].a = a;
+            pool->pairs[i].b = b;
+        }
+    }
+
+    return 0;
+}
+
+int hugepool_pairs(const hugepool_t *pool, int bit, int *pairs, int k) {
+    uint64_t flip;
+    int page, other, n = 0;
+
+    if (bit < pool->page_shift || bit >= 64) {
+        return -EINVAL;
+    }
+    flip = 1ULL << (bit - pool->page_shift);
+
+    for (page = 0; page < pool->nb_pages && n < k; page++) {
+        if (pool->frames[page] == 0 || (pool->frames[page] & flip)) {
+            continue;
+        }
+        other = hugepool_find(pool, pool->frames[page] ^ flip);
+        if (other >= 0) {
+            pairs[2 * n] = page;
+            pairs[2 * n + 1] = other;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+int hugepool_triples(const hugepool_t *pool, int bit, int *triples, int k) {
+    const hugepool_pair_t *p;
+    uint64_t flip, xor;
+    size_t i;
+    int c, n = 0;
+
+    if (bit < pool->page_shift || bit >= 64) {
+        return -EINVAL;
+    }
+    if (pool->pairs == NULL) {
+        return -ENOENT;
+    }
+    flip = 1ULL << (bit - pool->page_shift);
+
+    // Each triple is found once, from its highest page
+    for (c = 0; c < pool->nb_pages && n < k; c++) {
+        if (pool->frames[c] == 0) {
+            continue;
+        }
+        xor = pool->frames[c] ^ flip;
+        i = frame_hash(xor, pool->pairs_size);
+        for (; pool->pairs[i].xor != 0 && n < k;
+             i = (i + 1) & (pool->pairs_size - 1)) {
+            p = &pool->pairs[i];
+            if (p->xor == xor && p->b < c) {
+                triples[3 * n] = p->a;
+                triples[3 * n + 1] = p->b;
+                triples[3 * n + 2] = c;
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
+int hugepool_quads(const hugepool_t *pool, int bit, int *quads, int k) {
+    const hugepool_pair_t *p, *q;
+    uint64_t flip, xor;
+    size_t i, j;
+    int n = 0;
+
+    if (bit < pool->page_shift || bit >= 64) {
+        return -EINVAL;
+    }
+    if (pool->pairs == NULL) {
+        return -ENOENT;
+    }
+    flip = 1ULL << (bit - pool->page_shift);
+
+    // Each quadruple is found once, from the pair of its two highest pages
+    for (j = 0; j < pool->pairs_size && n < k; j++) {
+        q = &pool->pairs[j];
+        if (q->xor == 0) {
+            continue;
+        }
+        xor = q->xor ^ flip;
+        i = frame_hash(xor, pool->pairs_size);
+        for (; pool->pairs[i].xor != 0 && n < k;
+             i = (i + 1) & (pool->pairs_size - 1)) {
+            p = &pool->pairs[i];
+            if (p->xor == xor && p->b < q->a) {
+                quads[4 * n] = p->a;
+                quads[4 * n + 1] = p->b;
+                quads[4 * n + 2] = q->a;
+                quads[4 * n + 3] = q->b;
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,111 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_HUGEPOOL_H
+#define SLICE_REVERSE_HUGEPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Two distinct pages of a pool and the XOR of their frames (never 0: frames
+ * are distinct), 0 in an empty slot of the pair table
+ */
+typedef struct {
+    uint64_t xor;
+    int a, b;
+} hugepool_pair_t;
+
+/*
+ * The huge pages of a mapping, indexed by physical frame (the physical
+ * address >> page_shift, for 2M or 1G pages), to find pages whose physical
+ * addresses are in a given XOR relation.
+ *
+ * Frames are kept in an open addressing table of about twice the number of
+ * pages: the memory used depends on the number of pages, not on how spread
+ * they are in the physical address space, and looking a frame up is O(1).
+ * Pages whose frame is unknown (hidden PFNs) are left out.
+ */
+typedef struct {
+    char *mem;
+    int nb_pages;
+    int page_shift;
+    uint64_t *frames; // frame of each page, 0 if unknown
+    size_t size;      // slots of the table, a power of two
+    int *slots;       // page of each slot, -1 for an empty slot
+    size_t pairs_size;      // slots of the pair table, 0 if not indexed
+    hugepool_pair_t *pairs; // every pair of known pages, by XOR of frames
+} hugepool_t;
+
+// Largest pool whose pairs are indexed, about 16M of table
+#define HUGEPOOL_MAX_PAIRED 1024
+
+/*
+ * Index the nb_pages pages of 1 << page_shift bytes mapped at mem. Returns 0
+ * or a negative errno value.
+ */
+int hugepool_init(hugepool_t *pool, char *mem, int nb_pages, int page_shift);
+void hugepool_free(hugepool_t *pool);
+
+// Page of a frame, or -1 if the frame is not in the pool
+int hugepool_find(const hugepool_t *pool, uint64_t frame);
+
+/*
+ * Index every pair of pages by the XOR of their frames, for the triples and
+ * quadruples: O(n^2) once, then a triple costs one lookup per page and a
+ * quadruple one per pair. Returns 0, -E2BIG for a pool of more than
+ * HUGEPOOL_MAX_PAIRED pages, or another negative errno value.
+ */
+int hugepool_index_pairs(hugepool_t *pool);
+
+static inline uintptr_t hugepool_page(const hugepool_t *pool, int page) {
+    return (uintptr_t)pool->mem + ((uintptr_t)page << pool->page_shift);
+}
+
+/*
+ * Up to k pairs of pages whose physical addresses differ exactly in the
+ * given bit (pairs[2 * n] has the bit clear, pairs[2 * n + 1] set).
+ * Returns the number of pairs found, or -EINVAL for a bit inside a page.
+ */
+int hugepool_pairs(const hugepool_t *pool, int bit, int *pairs, int k);
+
+/*
+ * Up to k triples of distinct pages whose physical frames XOR to the given
+ * bit alone, in triples[3 * n] to triples[3 * n + 2]. With a linear hash, the
+ * slices of lines at offsets o1, o2 and o1 ^ o2 of the three pages XOR to the
+ * slice of the bit alone. Useful for bits that no pair isolates.
+ * Returns the number of triples found, -EINVAL for a bit inside a page or
+ * -ENOENT if the pairs are not indexed.
+ */
+int hugepool_triples(const hugepool_t *pool, int bit, int *triples, int k);
+
+/*
+ * Up to k quadruples of distinct pages whose physical frames XOR to the given
+ * bit alone, in quads[4 * n] to quads[4 * n + 3]: the slices of a line at the
+ * same offset in the four pages XOR to the slice of the bit alone. Two pairs
+ * of pages meet in the middle, for bits that neither a pair nor a triple
+ * isolates. Returns the number of quadruples found, -EINVAL for a bit inside
+ * a page or -ENOENT if the pairs are not indexed.
+ */
+int hugepool_quads(const hugepool_t *pool, int bit, int *quads, int k);
+
+#endif // SLICE_REVERSE_HUGEPOOL_H
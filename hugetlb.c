@@ -0,0 +1,112 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "hugetlb.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static void pool_dir(char *buf, size_t size, int node) {
+    if (node < 0) {
+        snprintf(buf, size, "/sys/kernel/mm/hugepages");
+    } else {
+        snprintf(buf, size, "/sys/devices/system/node/node%d/hugepages",
+                 node);
+    }
+}
+
+static long read_free(const char *dir, unsigned long kb) {
+    char path[256];
+    long nb = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/hugepages-%lukB/free_hugepages", dir, kb);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    if (fscanf(f, "%ld", &nb) != 1) {
+        nb = -1;
+    }
+    fclose(f);
+
+    return nb;
+}
+
+long hugetlb_free(int shift, int node) {
+    char dir[128];
+
+    pool_dir(dir, sizeof(dir), node);
+    return read_free(dir, 1UL << (shift - 10));
+}
+
+int hugetlb_sizes(hugetlb_size_t *sizes, int max, int node) {
+    char dir[128];
+    struct dirent *entry;
+    unsigned long kb;
+    hugetlb_size_t tmp;
+    DIR *d;
+    int i, n = 0;
+
+    pool_dir(dir, sizeof(dir), node);
+    d = opendir(dir);
+    if (d == NULL) {
+        return -errno;
+    }
+    while ((entry = readdir(d)) != NULL && n < max) {
+        if (sscanf(entry->d_name, "hugepages-%lukB", &kb) != 1 || kb == 0 ||
+            (kb & (kb - 1)) != 0) {
+            continue;
+        }
+        sizes[n].shift = __builtin_ctzl(kb) + 10;
+        sizes[n].free = read_free(dir, kb);
+        if (sizes[n].free < 0) {
+            continue;
+        }
+        // Insertion sort, largest size first
+        for (i = n; i > 0 && sizes[i - 1].shift < sizes[i].shift; i--) {
+            tmp = sizes[i - 1];
+            sizes[i - 1] = sizes[i];
+            sizes[i] = tmp;
+        }
+        n++;
+    }
+    closedir(d);
+
+    return n;
+}
+
+char *hugetlb_map(size_t nb_pages, int shift) {
+    return (char *)mmap(NULL, nb_pages << shift, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                            (shift << MAP_HUGE_SHIFT),
+                        -1, 0);
+}
@@ -0,0 +1,56 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#ifndef SLICE_REVERSE_HUGETLB_H
+#define SLICE_REVERSE_HUGETLB_H
+
+#include <stddef.h>
+
+/*
+ * Huge page sizes the kernel offers, from /sys/kernel/mm/hugepages (or
+ * /sys/devices/system/node/nodeN/hugepages for the pool of one node).
+ */
+
+#define HUGETLB_MAX_SIZES 4
+
+typedef struct {
+    int shift;          // log2 of the page size, 21 for 2M, 30 for 1G
+    long free;          // free pages of that size
+} hugetlb_size_t;
+
+/*
+ * Sizes with their free pages, largest first, for the whole machine if node
+ * is negative. Returns the number of sizes, or a negative errno value.
+ */
+int hugetlb_sizes(hugetlb_size_t *sizes, int max, int node);
+
+// Free pages of one size, -1 if the kernel does not offer that size
+long hugetlb_free(int shift, int node);
+
+/*
+ * Map nb_pages huge pages of 1 << shift bytes, not faulted in yet (see
+ * populate()). Returns MAP_FAILED on failure, like mmap.
+ */
+char *hugetlb_map(size_t nb_pages, int shift);
+
+#endif // SLICE_REVERSE_HUGETLB_H
@@ -0,0 +1,118 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "line_cache.h"
+
+static size_t line_hash(uint64_t line, size_t size) {
+    // Fibonacci hashing: consecutive lines spread over the table
+    return (line * 0x9E3779B97F4A7C15ULL) >> 32 & (size - 1);
+}
+
+int line_cache_init(line_cache_t *cache, size_t size) {
+    cache->size = 1;
+    while (cache->size < size) {
+        cache->size <<= 1;
+    }
+    cache->used = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->entries = (line_entry_t *)calloc(cache->size, sizeof(line_entry_t));
+    if (cache->entries == NULL) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void line_cache_free(line_cache_t *cache) {
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->size = 0;
+    cache->used = 0;
+}
+
+static line_entry_t *find(const line_cache_t *cache, uint64_t line) {
+    size_t i = line_hash(line, cache->size);
+
+    while (cache->entries[i].line != 0 && cache->entries[i].line != line) {
+        i = (i + 1) & (cache->size - 1);
+    }
+    return &cache->entries[i];
+}
+
+const line_entry_t *line_cache_lookup(line_cache_t *cache, uint64_t paddr) {
+    line_entry_t *e;
+
+    if (cache->entries == NULL || paddr >> 6 == 0) {
+        return NULL;
+    }
+    e = find(cache, paddr >> 6);
+    if (e->line == 0) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    return e;
+}
+
+static int grow(line_cache_t *cache) {
+    line_cache_t bigger;
+    size_t i;
+
+    if (line_cache_init(&bigger, cache->size * 2) < 0) {
+        return -ENOMEM;
+    }
+    for (i = 0; i < cache->size; i++) {
+        if (cache->entries[i].line != 0) {
+            *find(&bigger, cache->entries[i].line) = cache->entries[i];
+        }
+    }
+    bigger.used = cache->used;
+    bigger.hits = cache->hits;
+    bigger.misses = cache->misses;
+    free(cache->entries);
+    *cache = bigger;
+    return 0;
+}
+
+int line_cache_insert(line_cache_t *cache, uint64_t paddr, int slice,
+                      uint64_t margin) {
+    line_entry_t *e;
+
+    if (cache->entries == NULL || paddr >> 6 == 0) {
+        return -EINVAL;
+    }
+    if (2 * (cache->used + 1) > cache->size && grow(cache) < 0) {
+        return -ENOMEM;
+    }
+    e = find(cache, paddr >> 6);
+    if (e->line == 0) {
+        cache->used++;
+    }
+    e->line = paddr >> 6;
+    e->slice = slice;
+    e->margin = margin;
+    return 0;
+}
@@ -0,0 +1,55 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_LINE_CACHE_H
+#define SLICE_REVERSE_LINE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Slices already measured, keyed by physical line address (the slice of a
+ * line does not depend on the mapping it was reached through).
+ *
+ * Open addressing with linear probing, grown to keep the load under 1/2.
+ */
+typedef struct {
+    uint64_t line;   // physical address >> 6, 0 for an empty entry
+    int slice;
+    uint64_t margin; // confidence of the measurement, see probe_result_t
+} line_entry_t;
+
+typedef struct {
+    size_t size; // power of two
+    size_t used;
+    line_entry_t *entries;
+    unsigned long hits;
+    unsigned long misses;
+} line_cache_t;
+
+int line_cache_init(line_cache_t *cache, size_t size);
+void line_cache_free(line_cache_t *cache);
+const line_entry_t *line_cache_lookup(line_cache_t *cache, uint64_t paddr);
+int line_cache_insert(line_cache_t *cache, uint64_t paddr, int slice,
+                      uint64_t margin);
+
+#endif // SLICE_REVERSE_LINE_CACHE_H
@@ -0,0 +1,206 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "slice_hash.h"
+
+int model_init(model_t *model, int nb_slices, int nb_bits) {
+    if (nb_bits < 1 || nb_bits > MODEL_MAX_BITS || nb_slices < 1 ||
+        nb_slices > 256) {
+        return -EINVAL;
+    }
+    memset(model, 0, sizeof(*model));
+    model->nb_slices = nb_slices;
+    model->nb_bits = nb_bits;
+    model->table = (uint8_t *)calloc(1 << nb_bits, sizeof(uint8_t));
+    if (model->table == NULL) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+int model_copy(model_t *dst, const model_t *src) {
+    int ret = model_init(dst, src->nb_slices, src->nb_bits);
+
+    if (ret < 0) {
+        return ret;
+    }
+    memcpy(dst->masks, src->masks, sizeof(dst->masks));
+    memcpy(dst->table, src->table, 1 << src->nb_bits);
+    return 0;
+}
+
+void model_free(model_t *model) {
+    free(model->table);
+    model->table = NULL;
+}
+
+int model_eval(const model_t *model, uint64_t paddr) {
+    int j, index = 0;
+
+    for (j = 0; j < model->nb_bits; j++) {
+        index |= __builtin_parityll(paddr & model->masks[j]) << j;
+    }
+    return model->table[index];
+}
+
+void model_eval_batch(const model_t *model, const uint64_t *paddrs, size_t n,
+                      uint32_t *index, int *slices) {
+    size_t i;
+
+    slice_hash_index(model->masks, model->nb_bits, paddrs, n, index);
+    for (i = 0; i < n; i++) {
+        slices[i] = model->table[index[i]];
+    }
+}
+
+/*
+ * Parse one model from a stream, see model.h for the format. Parsing stops
+ * at the end of the line that completes the table, so that a stream may hold
+ * several models. Returns -ENOENT if the stream ends before any model.
+ */
+int model_read(model_t *model, FILE *f) {
+    char line[4096], *token, *save;
+    int nb_slices = -1, nb_bits = -1, in_table = 0, nb_entries = 0;
+    int j, empty = 1, ret = 0;
+    unsigned long long mask;
+    long value;
+
+    memset(model, 0, sizeof(*model));
+    while (ret == 0 && (!in_table || nb_entries < 1 << nb_bits) &&
+           fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "#\n")] = '\0';
+        token = strtok_r(line, " \t", &save);
+        while (ret == 0 && token != NULL) {
+            empty = 0;
+            if (in_table) {
+                value = strtol(token, NULL, 0);
+                if (nb_entries == 1 << nb_bits || value < 0 ||
+                    value >= nb_slices) {
+                    ret = -EINVAL;
+                    break;
+                }
+                model->table[nb_entries++] = value;
+            } else if (strcmp(token, "slices") == 0) {
+                token = strtok_r(NULL, " \t", &save);
+                nb_slices = token ? atoi(token) : -1;
+            } else if (strcmp(token, "bits") == 0) {
+                token = strtok_r(NULL, " \t", &save);
+                nb_bits = token ? atoi(token) : -1;
+                ret = model_init(model, nb_slices, nb_bits);
+            } else if (strcmp(token, "mask") == 0 && model->table != NULL) {
+                token = strtok_r(NULL, " \t", &save);
+                j = token ? atoi(token) : -1;
+                token = strtok_r(NULL, " \t", &save);
+                if (j < 0 || j >= nb_bits || token == NULL) {
+                    ret = -EINVAL;
+                    break;
+                }
+                mask = strtoull(token, NULL, 16);
+                model->masks[j] = mask;
+            } else if (strcmp(token, "table") == 0 && model->table != NULL) {
+                in_table = 1;
+            } else {
+                ret = -EINVAL;
+                break;
+            }
+            token = strtok_r(NULL, " \t", &save);
+        }
+    }
+
+    if (ret == 0 && empty) {
+        ret = -ENOENT;
+    } else if (ret == 0 && (!in_table || nb_entries != 1 << nb_bits)) {
+        ret = -EINVAL;
+    }
+    if (ret < 0) {
+        model_free(model);
+    }
+    return ret;
+}
+
+int model_load(model_t *model, const char *path) {
+    char line[4096];
+    int ret;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -errno;
+    }
+    ret = model_read(model, f);
+    if (ret == -ENOENT) {
+        ret = -EINVAL;
+    }
+
+    // Nothing but comments after the model
+    while (ret == 0 && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "#\n")] = '\0';
+        if (line[strspn(line, " \t")] != '\0') {
+            model_free(model);
+            ret = -EINVAL;
+        }
+    }
+    fclose(f);
+
+    return ret;
+}
+
+int model_write(const model_t *model, FILE *f) {
+    int i, j;
+
+    fprintf(f, "# slice = table[index], "
+               "bit j of index = parity(paddr & mask j)\n");
+    fprintf(f, "slices %d\n", model->nb_slices);
+    fprintf(f, "bits %d\n", model->nb_bits);
+    for (j = 0; j < model->nb_bits; j++) {
+        fprintf(f, "mask %d 0x%llx\n", j, (unsigned long long)model->masks[j]);
+    }
+    fprintf(f, "table");
+    for (i = 0; i < 1 << model->nb_bits; i++) {
+        fprintf(f, "%s%d", i % 32 ? " " : "\n", model->table[i]);
+    }
+    fprintf(f, "\n");
+
+    return ferror(f) ? -EIO : 0;
+}
+
+int model_save(const model_t *model, const char *path) {
+    int ret;
+    FILE *f;
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        return -errno;
+    }
+    ret = model_write(model, f);
+    if (fclose(f) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    return ret;
+}
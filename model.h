@@ -0,0 +1,71 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_MODEL_H
+#define SLICE_REVERSE_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Slice hash as a linear pre-hash followed by a lookup table, which also
+ * covers the non-linear hashes of non power of two slice counts:
+ *
+ *   index = sum over j of parity(paddr & masks[j]) << j
+ *   slice = table[index]
+ *
+ * A linear hash is the special case where table[index] == index.
+ *
+ * Text file format, '#' starts a comment:
+ *   slices <number of slices>
+ *   bits <number of pre-hash bits>
+ *   mask <j> <hexadecimal mask>       (one line per pre-hash bit)
+ *   table <2^bits slices>
+ */
+
+#define MODEL_MAX_BITS 16
+
+typedef struct {
+    int nb_slices;
+    int nb_bits;
+    uint64_t masks[MODEL_MAX_BITS];
+    uint8_t *table; // 1 << nb_bits entries
+} model_t;
+
+int model_init(model_t *model, int nb_slices, int nb_bits);
+int model_copy(model_t *dst, const model_t *src);
+void model_free(model_t *model);
+int model_load(model_t *model, const char *path);
+int model_save(const model_t *model, const char *path);
+int model_read(model_t *model, FILE *f);
+int model_write(const model_t *model, FILE *f);
+int model_eval(const model_t *model, uint64_t paddr);
+
+/*
+ * Slices of n addresses, with the pre-hash of all of them computed at once by
+ * slice_hash_index(). index is scratch space of n entries.
+ */
+void model_eval_batch(const model_t *model, const uint64_t *paddrs, size_t n,
+                      uint32_t *index, int *slices);
+
+#endif // SLICE_REVERSE_MODEL_H
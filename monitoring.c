@@ -24,460 +24,951 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <pthread.h>
 #include <sched.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "arch.h"
 #include "global_variables.h"
 #include "monitoring.h"
+#include "msr.h"
+#include "perf_uncore.h"
 #include "poke.h"
-#include "rdmsr.h"
+#include "topology.h"
+#include "translate.h"
 #include "util.h"
-#include "wrmsr.h"
 
 #define SIZE_HIST (600)
 
-int monitor_single_address_clflush(uintptr_t addr, int print) {
-    uintptr_t paddr = read_pagemap("/proc/self/pagemap", addr);
+/*
+ * Use the kernel uncore PMUs through perf_event_open instead of the msr device
+ */
+int monitoring_perf = 0;
+
+/*
+ * Do not use performance counters but the clflush timing method
+ */
+int monitoring_clflush = 0;
+
+/*
+ * Delta sampling: the counters are started once when armed and left running.
+ * Each probe snapshots them before and after poking and keeps the difference,
+ * so there is no reset/freeze round of writes per address.
+ */
+int monitoring_delta = 0;
+
+/*
+ * Poke several addresses in the same counter window, see monitor_probe_batch()
+ */
+int monitoring_batch = 0;
+
+/*
+ * Adaptive poking: poke in chunks and stop as soon as the leading slice beats
+ * the runner-up by adaptive_margin standard deviations (0 disables it).
+ * nb_pokes stays the hard cap for noisy addresses.
+ */
+double adaptive_margin = 0;
+int adaptive_chunk = 1000;
+
+/*
+ * Probe engine
+ *
+ * A backend is chosen once by monitor_arm(). It programs what it needs, and
+ * each monitor_probe() then goes straight to the backend functions, which
+ * fill the per-run scratch buffer with one count per slice.
+ * Counter backends provide start/stop/read and the engine pokes between
+ * them; the clflush backend provides its own probe function, which is told
+ * the next address of the batch so that it can prepare it.
+ * Probes do no allocation, no sorting and no I/O.
+ */
+typedef struct {
+    const char *name;
+    int (*arm)(void);
+    int (*start)(void);
+    int (*stop)(void);
+    int (*read)(uint64_t *counts);
+    int (*probe)(uintptr_t addr, uintptr_t next, uintptr_t *paddr,
+                 uint64_t *counts);
+    void (*disarm)(void);
+} probe_backend_t;
+
+static const probe_backend_t *backend = NULL;
+static int nb_counts = 0;
+static uint64_t *scratch_counts = NULL;
+static uint64_t *scratch_before = NULL; // snapshot taken before poking
+static uint64_t counter_mask = ~0ULL;
+static unsigned long long nb_probes = 0;
+static unsigned long long total_pokes = 0;
+static unsigned long long nb_batches = 0;
+static unsigned long long nb_batch_fallbacks = 0;
+static struct timespec arm_time;
+
+/*
+ * All MSR accesses go through the session shared with rdmsr and wrmsr, so
+ * the msr device is opened once for the whole run.
+ */
+static msr_session_t *session = NULL;
+
+static int uncore_session(void) {
+    int ret;
+
+    if (session != NULL) {
+        return 0;
+    }
+    ret = msr_shared_session(&session);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open MSR session: %s\n", strerror(-ret));
+    }
+    return ret;
+}
 
-    unsigned long cores_package = cores_per_package();
+static int uncore_write(uint32_t reg, uint64_t val) {
+    int ret = uncore_session();
 
-    int *map_coreid = mapping_coreid();
-    int *map_apicid = mapping_apicid();
-    int i, j, thread;
+    if (ret < 0) {
+        return ret;
+    }
+    ret = msr_write(session, socket_ctx->cpu, reg, val);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot write MSR 0x%x on CPU %d: %s\n", reg,
+                socket_ctx->cpu, strerror(-ret));
+    }
+    return ret;
+}
 
-    size_t hit_histogram[SIZE_HIST];
-    int nb_tries = 50 * 1024;
-
-    /*
-     * Execute some code on every core (!= every thread)
-     */
-
-    int *core_used;
-    core_used = (int *)calloc(cores_package, sizeof(int));
-    unsigned long current_apicid = -1;
-    int current_core = -1;
-
-    int mask;
-    int n = threads_per_package();
-    int slice = 0;
-
-    for (thread = 0; thread < n; thread++) {
-        mask = thread;
-        cpu_set_t my_set;  // Define your cpu_set bit mask.
-        CPU_ZERO(&my_set); // Initialize it all to 0, i.e. no CPUs selected.
-        CPU_SET(mask, &my_set); // set the bit that represents core
-        // Set affinity of this process to mask
-        if (sched_setaffinity(0, sizeof(cpu_set_t), &my_set) == -1) {
-            printf("Error with sched_setaffinity\n");
-            exit(-1);
+// Write the same value to one register of every CBo
+static int uncore_write_boxes(unsigned long long *regs, uint64_t val) {
+    int i, ret;
+
+    for (i = 0; i < socket_ctx->nb_cores; i++) {
+        ret = uncore_write(regs[i], val);
+        if (ret < 0) {
+            return ret;
         }
+    }
+    return 0;
+}
 
-        current_apicid = current_apic();
-        current_core = apicid2coreid(current_apicid, map_apicid, map_coreid);
+// Read one register of every CBo
+static int uncore_read_boxes(unsigned long long *regs, uint64_t *vals) {
+    int i;
+    int ret = uncore_session();
 
-        memset(hit_histogram, 0, SIZE_HIST * sizeof(*hit_histogram));
+    if (ret < 0) {
+        return ret;
+    }
+    for (i = 0; i < socket_ctx->nb_cores; i++) {
+        ret = msr_read(session, socket_ctx->cpu, regs[i], &vals[i]);
+        if (ret < 0) {
+            fprintf(stderr, "Cannot read MSR 0x%llx on CPU %d: %s\n",
+                    regs[i], socket_ctx->cpu, strerror(-ret));
+            return ret;
+        }
+    }
+    return 0;
+}
 
-        if (core_used[current_core] == 0)
-        // Code to execute in every core
-        {
-            // Construct clflush hit histogram
-            for (i = 0; i < nb_tries; ++i) {
-                size_t d = flush_hit((char *)addr);
-                hit_histogram[MIN(599, d)]++;
-                for (j = 0; j < 1; ++j)
-                    sched_yield();
-            }
+static double elapsed_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) +
+           (now.tv_nsec - start->tv_nsec) / 1e9;
+}
 
-// Print histogram for each core if not sure of what the threshold values should
-// be
-//#define DEBUG
-#ifdef DEBUG
-            for (i = 145; i < 180; ++i) {
-                printf("%3d: %15zu\n", i, hit_histogram[i]);
-            }
-#endif
+/*
+ * Core CBo backend
+ */
 
-            // Based on the historgram, is the address on the same slice as the
-            // executing core?
-            if (same_slice(hit_histogram)) {
-                slice = current_core;
-            }
+static int arm_core(void) {
+    // Disable counters
+    if (uncore_write(socket_ctx->msr_unc_perf_global_ctr,
+                     socket_ctx->val_disable_ctrs) < 0) {
+        return -1;
+    }
 
-            // Current core has been used (do not remove)
-            core_used[current_core] = 1;
-        }
+    // Select event to monitor
+    if (uncore_write_boxes(socket_ctx->msr_unc_cbo_perfevtsel0,
+                           socket_ctx->val_select_evt_core) < 0) {
+        return -1;
     }
 
-    // Pretty print
-    if (print) {
-        print_bin(paddr);
-        printf(" %d\n", slice);
+    return 0;
+}
+
+static int start_core(void) {
+    // Reset counters
+    if (uncore_write_boxes(socket_ctx->msr_unc_cbo_per_ctr0,
+                           socket_ctx->val_reset_ctrs) < 0) {
+        return -1;
     }
 
-    return slice;
+    // Enable counting
+    return uncore_write(socket_ctx->msr_unc_perf_global_ctr,
+                        socket_ctx->val_enable_ctrs);
 }
 
-int monitor_single_address_core(uintptr_t addr, int print) {
-    int i;
+static int stop_core(void) {
+    // Disable counting
+    return uncore_write(socket_ctx->msr_unc_perf_global_ctr,
+                        socket_ctx->val_disable_ctrs);
+}
 
-    // Disable counters
-    uint64_t val[] = {val_disable_ctrs};
-    wrmsr_on_cpu_0(msr_unc_perf_global_ctr, 1, val);
+static int read_core(uint64_t *counts) {
+    return uncore_read_boxes(socket_ctx->msr_unc_cbo_per_ctr0, counts);
+}
 
-    // Reset counters
-    val[0] = val_reset_ctrs;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_unc_cbo_per_ctr0[i], 1, val);
-    }
+static void disarm_core(void) {
+    uncore_write(socket_ctx->msr_unc_perf_global_ctr,
+                 socket_ctx->val_disable_ctrs);
+}
 
-    // Select event to monitor
-    val[0] = val_select_evt_core;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_unc_cbo_perfevtsel0[i], 1, val);
+/*
+ * Xeon CBo backend
+ */
+
+static int arm_xeon(void) {
+    // The whole setup is explained in the section 2.1.2 of the manual (p15)
+    // Beware: it is written to reset all counters after enabling monitoring and
+    // selecting event to monitor, while the reset should be done before
+
+    // Reset control and counters, leaving the boxes frozen
+    if (uncore_write_boxes(socket_ctx->msr_pmon_box_ctl,
+                           socket_ctx->val_box_reset) < 0) {
+        return -1;
     }
 
     // Enable counting
-    val[0] = val_enable_ctrs;
-    // val[0] = val_enable_ctrs;
-    wrmsr_on_cpu_0(msr_unc_perf_global_ctr, 1, val);
-
-    // Launch program to monitor
-    uintptr_t paddr;
-    paddr = poke(addr);
-
-    /*
-      // Disable counters
-      val[0] = val_disable_ctrs;
-      wrmsr_on_cpu_0(msr_unc_perf_global_ctr,1,val);
-    */
-
-    // Read counter
-    int *cboxes = calloc(max_slices, sizeof(int));
-    int *cboxes_tri = calloc(max_slices, sizeof(int));
-    int res_temp;
-    for (i = 0; i < nb_cores; i++) {
-        res_temp = rdmsr_on_cpu_0(msr_unc_cbo_per_ctr0[i]);
-        cboxes[i] = ((res_temp - nb_pokes) < 0) ? 0 : res_temp - nb_pokes;
-        cboxes_tri[i] = ((res_temp - nb_pokes) < 0) ? 0 : res_temp - nb_pokes;
-    }
-
-    int slice = 0;
-    int first = 0;
-    int second = 0;
-    float percent;
-
-    // Interpreting the results
-    //
-
-    // Finding the slice in which the address is
-    for (i = 0; i < max_slices; i++) {
-        if (cboxes[i] > cboxes[slice]) {
-            slice = i;
-        }
+    if (uncore_write_boxes(socket_ctx->msr_pmon_ctl0,
+                           socket_ctx->val_enable_counting) < 0) {
+        return -1;
     }
 
-    // Calculate the ratio between the first and the second result
-    // to estimate the error
-    quicksort(cboxes_tri, 0, max_slices - 1);
-    first = cboxes_tri[max_slices - 1];
-    second = cboxes_tri[max_slices - 2];
-    percent = ((float)second) / ((float)first) * 100;
+    // Select event to monitor: umask and filter
+    if (uncore_write_boxes(socket_ctx->msr_pmon_ctl0,
+                           socket_ctx->val_select_event) < 0) {
+        return -1;
+    }
+    if (uncore_write_boxes(socket_ctx->msr_pmon_box_filter,
+                           socket_ctx->val_filter) < 0) {
+        return -1;
+    }
 
-    // Pretty print
-    if (print) {
-        print_bin(paddr);
-        printf(" %d %6.2f", slice, percent);
-        for (i = 0; i < nb_cores; i++) {
-            printf(" % 6d", cboxes[i]);
-        }
-        printf("\n");
+    return 0;
+}
+
+static int start_xeon(void) {
+    // Reset counters (but not the control registers armed earlier)
+    if (uncore_write_boxes(socket_ctx->msr_pmon_box_ctl,
+                           socket_ctx->val_box_reset_ctrs) < 0) {
+        return -1;
     }
 
-    free(cboxes);
-    free(cboxes_tri);
+    // Unfreezing box counters
+    return uncore_write_boxes(socket_ctx->msr_pmon_box_ctl,
+                              socket_ctx->val_box_unfreeze);
+}
 
-    return slice;
+static int stop_xeon(void) {
+    // Freeze box counters
+    return uncore_write_boxes(socket_ctx->msr_pmon_box_ctl,
+                              socket_ctx->val_box_freeze);
 }
 
-int monitor_single_address_fast(uintptr_t addr) {
-    // Session monitoring
-    //
-    // The whole setup is explained in the section 2.1.2 of the manual (p15)
-    // Beware: it is written to reset all counters after enabling monitoring and
-    // selecting event to monitor, while the reset should be done before
+static int read_xeon(uint64_t *counts) {
+    return uncore_read_boxes(socket_ctx->msr_pmon_ctr0, counts);
+}
 
-    int i;
+static void disarm_xeon(void) {
+    uncore_write_boxes(socket_ctx->msr_pmon_box_ctl,
+                       socket_ctx->val_box_freeze);
+}
 
-    // Freeze box counters
+/*
+ * perf_event_open backend (Core or Xeon)
+ */
+
+static perf_uncore_t perf;
 
-    uint64_t val[] = {val_box_freeze};
+static int arm_perf(void) {
+    uint64_t config, config1;
+    int ret;
 
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctr0[i], 1, val);
+    // The event comes from the PMU formats, not from the MSR tables of arch.c
+    ret = perf_uncore_llc_event(&config, &config1);
+    if (ret == 0) {
+        ret = perf_uncore_open(&perf, socket_ctx->nb_cores, socket_ctx->cpu,
+                               config, config1);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Cannot open uncore perf events: %s\n",
+                strerror(-ret));
+        return -1;
+    }
+    if (verbose) {
+        printf("Reading %d uncore counters, config 0x%llx config1 0x%llx\n",
+               perf.nb_boxes, (unsigned long long)config,
+               (unsigned long long)config1);
     }
 
-    // Reset counters
-    val[0] = val_box_reset;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+    return 0;
+}
+
+static int start_perf(void) {
+    int ret;
+
+    if ((ret = perf_uncore_reset(&perf)) < 0 ||
+        (ret = perf_uncore_enable(&perf)) < 0) {
+        fprintf(stderr, "Cannot start uncore counters: %s\n", strerror(-ret));
+        return -1;
     }
+    return 0;
+}
 
-    // Enable counting
-    val[0] = val_enable_counting;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctl0[i], 1, val);
+static int stop_perf(void) {
+    int ret = perf_uncore_disable(&perf);
+
+    if (ret < 0) {
+        fprintf(stderr, "Cannot stop uncore counters: %s\n", strerror(-ret));
     }
+    return ret;
+}
 
-    // Select event to monitor: umask and filter
-    val[0] = val_select_event;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctl0[i], 1, val);
+static int read_perf(uint64_t *counts) {
+    int ret = perf_uncore_read(&perf, counts);
+
+    if (ret < 0) {
+        fprintf(stderr, "Cannot read uncore counters: %s\n", strerror(-ret));
     }
-    val[0] = val_filter;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_filter[i], 1, val);
+    return ret;
+}
+
+static void disarm_perf(void) {
+    perf_uncore_close(&perf);
+}
+
+/*
+ * clflush backend: the address is timed from every core, and it is in the
+ * slice of the core on which it is flushed the fastest.
+ *
+ * One worker thread per core of the package stays pinned to the first thread
+ * of its core for the whole run. The coordinator hands the address to each
+ * worker in turn by bumping its ticket, and spins until the worker publishes
+ * the same value in done. Workers are served one after the other so that two
+ * cores never time flushes at the same time. The core the coordinator runs on
+ * is timed by the coordinator itself.
+ *
+ * The addresses of a batch form a pipeline: while the first remote worker
+ * times address N, the coordinator translates address N+1, so that the
+ * pagemap read is off the critical path when N+1 is handed out.
+ */
+
+#define CLFLUSH_TRIES (50 * 1024)
+#define CLFLUSH_EXIT ((unsigned long)-1)
+
+typedef struct {
+    pthread_t thread;
+    int core;
+    int cpu;
+    int local;                   // core of the driving CPU, timed inline
+    uintptr_t addr;              // written before ticket is bumped
+    uint64_t hits;               // valid once done == ticket
+    atomic_ulong ticket;
+    atomic_ulong done;
+} clflush_worker_t;
+
+static clflush_worker_t *workers = NULL;
+static int nb_workers = 0;
+static unsigned long clflush_ticket = 0;
+static uintptr_t prepared_va = 0; // next address, translated in advance
+static uintptr_t prepared_pa = 0;
+
+static inline void cpu_relax(void) {
+    asm volatile("pause" ::: "memory");
+}
+
+static uint64_t clflush_hits(uintptr_t addr) {
+    size_t hit_histogram[SIZE_HIST];
+    int i;
+
+    // Construct clflush hit histogram
+    memset(hit_histogram, 0, SIZE_HIST * sizeof(*hit_histogram));
+    for (i = 0; i < CLFLUSH_TRIES; ++i) {
+        size_t d = flush_hit((char *)addr);
+        hit_histogram[MIN(SIZE_HIST - 1, d)]++;
     }
 
-    // Unfreezing box counters
-    val[0] = val_box_unfreeze;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+// Print histogram for each core if not sure of what the threshold values should
+// be
+//#define DEBUG
+#ifdef DEBUG
+    for (i = 145; i < 180; ++i) {
+        printf("%3d: %15zu\n", i, hit_histogram[i]);
     }
+#endif
 
-    // Launch program to monitor
-    uintptr_t paddr;
-    paddr = poke(addr);
+    // Based on the historgram, how often is the address flushed as
+    // fast as from the core of its own slice?
+    return fast_hits(hit_histogram);
+}
 
-    // Freeze box counters
-    val[0] = val_box_freeze;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+static void *clflush_worker(void *arg) {
+    clflush_worker_t *w = (clflush_worker_t *)arg;
+    unsigned long last = 0, ticket;
+
+    for (;;) {
+        while ((ticket = atomic_load_explicit(&w->ticket,
+                                              memory_order_acquire)) == last) {
+            cpu_relax();
+        }
+        if (ticket == CLFLUSH_EXIT) {
+            break;
+        }
+        last = ticket;
+
+        w->hits = clflush_hits(w->addr);
+        atomic_store_explicit(&w->done, ticket, memory_order_release);
     }
 
-    // Read counters
-    //
-    int *cboxes = calloc(max_slices, sizeof(int));
-    int *cboxes_tri = calloc(max_slices, sizeof(int));
-    int res_temp;
-    for (i = 0; i < nb_cores; i++) {
-        res_temp = rdmsr_on_cpu_0(msr_pmon_ctr0[i]);
-        cboxes[i] = ((res_temp - nb_pokes) < 0) ? 0 : res_temp - nb_pokes;
-        cboxes_tri[i] = ((res_temp - nb_pokes) < 0) ? 0 : res_temp - nb_pokes;
-    }
-
-    int slice = 0;
-    int first = 0;
-    int second = 0;
-    float percent;
-
-    // Interpreting the results
-    //
-
-    // Finding the slice in which the address is
-    for (i = 0; i < max_slices; i++) {
-        if (cboxes[i] > cboxes[slice]) {
-            slice = i;
+    return NULL;
+}
+
+static void stop_workers(void) {
+    int i;
+
+    for (i = 0; i < nb_workers; i++) {
+        if (workers[i].local) {
+            continue;
         }
+        atomic_store_explicit(&workers[i].ticket, CLFLUSH_EXIT,
+                              memory_order_release);
+        pthread_join(workers[i].thread, NULL);
     }
+    free(workers);
+    workers = NULL;
+    nb_workers = 0;
+}
 
-    // Calculate the ratio between the first and the second result
-    // to estimate the error
-    quicksort(cboxes_tri, 0, max_slices - 1);
-    first = cboxes_tri[max_slices - 1];
-    second = cboxes_tri[max_slices - 2];
-    percent = ((float)second) / ((float)first) * 100;
+static int arm_clflush(void) {
+    int package = socket_ctx->package;
+    pthread_attr_t attr;
+    cpu_set_t my_set;
+    int core, ret;
+
+    if (package < 0) {
+        fprintf(stderr, "Unknown package for CPU %d\n", socket_ctx->cpu);
+        return -1;
+    }
+    workers = (clflush_worker_t *)calloc(nb_counts, sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "Cannot allocate clflush workers\n");
+        return -1;
+    }
+
+    clflush_ticket = 0;
+    prepared_va = 0;
+    prepared_pa = 0;
+    pthread_attr_init(&attr);
+    for (core = 0; core < nb_counts; core++) {
+        clflush_worker_t *w = &workers[nb_workers];
+
+        w->core = core;
+        w->cpu = topology_core_cpu(package, core);
+        if (w->cpu < 0) {
+            continue;
+        }
+        atomic_init(&w->ticket, 0);
+        atomic_init(&w->done, 0);
+
+        // The coordinator would compete with a worker on its own CPU
+        w->local = (topology_cpu_core(socket_ctx->cpu) == core);
+        if (w->local) {
+            nb_workers++;
+            continue;
+        }
 
-    // Pretty print
-    print_bin(paddr);
-    printf(" %d %6.2f", slice, percent);
-    for (i = 0; i < nb_cores; i++) {
-        printf(" % 6d", cboxes[i]);
+        // Start the worker already pinned, it never migrates afterwards
+        CPU_ZERO(&my_set);
+        CPU_SET(w->cpu, &my_set);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &my_set);
+        ret = pthread_create(&w->thread, &attr, clflush_worker, w);
+        if (ret != 0) {
+            fprintf(stderr, "Cannot start clflush worker on CPU %d: %s\n",
+                    w->cpu, strerror(ret));
+            pthread_attr_destroy(&attr);
+            stop_workers();
+            return -1;
+        }
+        nb_workers++;
+    }
+    pthread_attr_destroy(&attr);
+    if (nb_workers == 0) {
+        fprintf(stderr, "No online core in package %d\n", package);
+        stop_workers();
+        return -1;
     }
-    printf("\n");
 
-    free(cboxes);
-    free(cboxes_tri);
+    return 0;
+}
 
-    return slice;
+/*
+ * Translate the current address unless it was prepared, then the next one
+ */
+static void prepare_clflush(uintptr_t addr, uintptr_t next, uintptr_t *paddr) {
+    *paddr = (addr == prepared_va) ? prepared_pa : translate(addr);
+    prepared_va = next;
+    prepared_pa = next != 0 ? translate(next) : 0;
 }
 
-int monitor_single_address_print(uintptr_t addr) {
-    // Session monitoring
-    //
-    // The whole setup is explained in the section 2.1.2 of the manual (p15)
-    // Beware: it is written to reset all counters after enabling monitoring and
-    // selecting event to monitor, while the reset should be done before
+static int probe_clflush(uintptr_t addr, uintptr_t next, uintptr_t *paddr,
+                         uint64_t *counts) {
+    unsigned long ticket = ++clflush_ticket;
+    int i, prepared = 0;
 
-    int i;
+    memset(counts, 0, nb_counts * sizeof(*counts));
 
-    // Freeze box counters
-    uint64_t val[] = {val_box_freeze};
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctr0[i], 1, val);
+    for (i = 0; i < nb_workers; i++) {
+        clflush_worker_t *w = &workers[i];
+
+        if (w->local) {
+            counts[w->core] = clflush_hits(addr);
+            continue;
+        }
+
+        w->addr = addr;
+        atomic_store_explicit(&w->ticket, ticket, memory_order_release);
+
+        // Translations run while another core is timing the address
+        if (!prepared) {
+            prepare_clflush(addr, next, paddr);
+            prepared = 1;
+        }
+
+        while (atomic_load_explicit(&w->done, memory_order_acquire) != ticket) {
+            cpu_relax();
+        }
+        counts[w->core] = w->hits;
+    }
+    if (!prepared) {
+        prepare_clflush(addr, next, paddr);
     }
 
-    // Reset counters
-    val[0] = val_box_reset;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+    return 0;
+}
+
+static void disarm_clflush(void) {
+    stop_workers();
+}
+
+static const probe_backend_t core_backend = {
+    "core CBo", arm_core, start_core, stop_core, read_core, NULL, disarm_core};
+static const probe_backend_t xeon_backend = {
+    "xeon CBo", arm_xeon, start_xeon, stop_xeon, read_xeon, NULL, disarm_xeon};
+static const probe_backend_t perf_backend = {
+    "perf uncore", arm_perf, start_perf, stop_perf, read_perf, NULL,
+    disarm_perf};
+static const probe_backend_t clflush_backend = {
+    "clflush", arm_clflush, NULL, NULL, NULL, probe_clflush, disarm_clflush};
+
+/*
+ * Engine
+ */
+
+static void free_scratch(void) {
+    free(scratch_counts);
+    free(scratch_before);
+    scratch_counts = NULL;
+    scratch_before = NULL;
+    backend = NULL;
+}
+
+int monitor_arm(void) {
+    if (monitoring_clflush) {
+        backend = &clflush_backend;
+    } else if (monitoring_perf) {
+        backend = &perf_backend;
+    } else if (socket_ctx->class == INTEL_CORE) {
+        backend = &core_backend;
+    } else {
+        backend = &xeon_backend;
     }
 
-    // Enable counting
-    val[0] = val_enable_counting;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctl0[i], 1, val);
+    if (monitoring_delta && backend->probe != NULL) {
+        fprintf(stderr, "Delta sampling needs performance counters\n");
+        backend = NULL;
+        return -1;
     }
 
-    // Select event to monitor: umask and filter
-    val[0] = val_select_event;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctl0[i], 1, val);
+    nb_counts = socket_ctx->nb_cores;
+    scratch_counts = (uint64_t *)calloc(nb_counts, sizeof(uint64_t));
+    scratch_before = (uint64_t *)calloc(nb_counts, sizeof(uint64_t));
+    if (scratch_counts == NULL || scratch_before == NULL) {
+        fprintf(stderr, "Cannot allocate probe scratch buffers\n");
+        free_scratch();
+        return -1;
     }
-    val[0] = val_filter;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_filter[i], 1, val);
+
+    // The kernel accumulates perf counts on 64 bits
+    counter_mask = ~0ULL;
+    if (backend != &perf_backend && socket_ctx->counter_width < 64) {
+        counter_mask = (1ULL << socket_ctx->counter_width) - 1;
     }
 
-    // Unfreezing box counters
-    val[0] = val_box_unfreeze;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+    if (backend->arm() < 0) {
+        free_scratch();
+        return -1;
+    }
+    if (monitoring_delta && backend->start() < 0) {
+        backend->disarm();
+        free_scratch();
+        return -1;
+    }
+    if (verbose) {
+        printf("Probing with the %s backend\n", backend->name);
     }
 
-    // Launch program to monitor
-    uintptr_t paddr;
-    paddr = poke(addr);
+    nb_probes = 0;
+    total_pokes = 0;
+    nb_batches = 0;
+    nb_batch_fallbacks = 0;
+    clock_gettime(CLOCK_MONOTONIC, &arm_time);
 
-    // Freeze box counters
-    val[0] = val_box_freeze;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+    return 0;
+}
+
+// Find the slice with the highest count and the runner-up
+static void rank_counts(const uint64_t *counts, int *slice, int *second) {
+    int i;
+
+    *slice = 0;
+    *second = -1;
+    for (i = 1; i < nb_counts; i++) {
+        if (counts[i] > counts[*slice]) {
+            *second = *slice;
+            *slice = i;
+        } else if (*second < 0 || counts[i] > counts[*second]) {
+            *second = i;
+        }
     }
+}
 
-    // Read counters
-    //
-    int *cboxes = calloc(max_slices, sizeof(int));
-    int *cboxes_tri = calloc(max_slices, sizeof(int));
-    for (i = 0; i < nb_cores; i++) {
-        cboxes[i] = rdmsr_on_cpu_0(msr_pmon_ctr0[i]);
-        cboxes_tri[i] = rdmsr_on_cpu_0(msr_pmon_ctr0[i]);
-    }
-
-    int slice = 0;
-    int first = 0;
-    int second = 0;
-    float percent;
-
-    // Interpreting the results
-    //
-
-    // Finding the slice in which the address is
-    for (i = 0; i < max_slices; i++) {
-        if (cboxes[i] > cboxes[slice]) {
-            slice = i;
+/*
+ * Is the leading slice ahead of the runner-up by adaptive_margin standard
+ * deviations? Lookup counts are treated as Poisson, so the difference of the
+ * two counts has a variance of their sum.
+ */
+static int is_decided(const uint64_t *counts) {
+    int slice, second;
+
+    rank_counts(counts, &slice, &second);
+    if (second < 0) {
+        return 1;
+    }
+    double diff = (double)counts[slice] - (double)counts[second];
+    double sum = (double)counts[slice] + (double)counts[second];
+
+    return diff > 0 && diff * diff >= adaptive_margin * adaptive_margin * sum;
+}
+
+/*
+ * Read the counters of every slice. In delta mode, return the number of
+ * events since the snapshot; counters wrap at counter_width bits, which the
+ * masked unsigned difference handles.
+ */
+static int read_counts(uint64_t *counts) {
+    int i;
+
+    if (backend->read(counts) < 0) {
+        return -1;
+    }
+    if (monitoring_delta) {
+        for (i = 0; i < nb_counts; i++) {
+            counts[i] = (counts[i] - scratch_before[i]) & counter_mask;
         }
     }
+    return 0;
+}
 
-    // Calculate the ratio between the first and the second result
-    // to estimate the error
-    quicksort(cboxes_tri, 0, max_slices - 1);
-    first = cboxes_tri[max_slices - 1];
-    second = cboxes_tri[max_slices - 2];
-    percent = ((float)second) / ((float)first) * 100;
+static int probe_counters(uintptr_t addr, probe_result_t *res,
+                          uint64_t *counts) {
+    if (monitoring_delta) {
+        if (backend->read(scratch_before) < 0) {
+            return -1;
+        }
+    } else if (backend->start() < 0) {
+        return -1;
+    }
+
+    if (adaptive_margin > 0) {
+        // Launch program to monitor, one chunk at a time
+        res->pokes = 0;
+        do {
+            int chunk = MIN(adaptive_chunk, nb_pokes - res->pokes);
+            res->paddr = poke_n(addr, chunk);
+            res->pokes += chunk;
+            if (read_counts(counts) < 0) {
+                return -1;
+            }
+        } while (res->pokes < nb_pokes && !is_decided(counts));
 
-    // Pretty print
-    print_bin(paddr);
-    printf(" %d %6.2f", slice, percent);
-    for (i = 0; i < nb_cores; i++) {
-        printf(" % 6d", cboxes[i]);
+        // Free-running counters: the last read is the result
+        if (monitoring_delta) {
+            return 0;
+        }
+    } else {
+        // Launch program to monitor
+        res->paddr = poke(addr);
+        res->pokes = nb_pokes;
     }
-    printf("\n");
 
-    free(cboxes);
-    free(cboxes_tri);
+    if (!monitoring_delta && backend->stop() < 0) {
+        return -1;
+    }
 
-    return slice;
+    // Read counters
+    return read_counts(counts);
 }
 
-int monitor_single_address(uintptr_t addr) {
-    // Session monitoring
-    //
-    // The whole setup is explained in the section 2.1.2 of the manual (p15)
-    // Beware: it is written to reset all counters after enabling monitoring and
-    // selecting event to monitor, while the reset should be done before
+/*
+ * Probe one address; next is the address probed right after it, 0 if none
+ */
+static int probe_one(uintptr_t addr, uintptr_t next, probe_result_t *res) {
+    uint64_t *counts = scratch_counts;
+    int ret;
 
-    int i;
+    if (backend == NULL) {
+        fprintf(stderr, "Counters are not armed\n");
+        return -1;
+    }
 
-    // Freeze box counters
-    uint64_t val[] = {val_box_freeze};
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctr0[i], 1, val);
+    if (backend->probe != NULL) {
+        res->pokes = 0;
+        ret = backend->probe(addr, next, &res->paddr, counts);
+    } else {
+        ret = probe_counters(addr, res, counts);
+    }
+    if (ret < 0) {
+        return -1;
     }
+    nb_probes++;
+    total_pokes += res->pokes;
 
-    // Reset counters
-    val[0] = val_box_reset;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+    int slice, second;
+    rank_counts(counts, &slice, &second);
+
+    res->slice = slice;
+    res->second = second;
+    res->margin = second < 0 ? counts[slice] : counts[slice] - counts[second];
+    res->counts = counts;
+    res->nb_counts = nb_counts;
+    res->batch = 1;
+
+    return 0;
+}
+
+int monitor_probe(uintptr_t addr, probe_result_t *res) {
+    return probe_one(addr, 0, res);
+}
+
+/*
+ * Multiplexed probing
+ *
+ * Several addresses are poked in the same counter window, address k being
+ * poked base << k times. Each poke adds the same number u of lookups to the
+ * slice of its address, so once the baseline of the slices holding none of
+ * the addresses is removed, count_s = u * base * m_s, where the bits of m_s
+ * are the addresses held by slice s. Batches are limited to nb_counts - 1
+ * addresses so that at least one slice gives the baseline.
+ */
+
+int monitor_batch_size(void) {
+    // Backends with their own probe measure a batch one address after the
+    // other, and pipeline the preparation of each address
+    if (backend != NULL && backend->probe != NULL) {
+        return MAX_BATCH;
+    }
+    if (!monitoring_batch || backend == NULL) {
+        return 1;
+    }
+    return MAX(1, MIN(MAX_BATCH, nb_counts - 1));
+}
+
+/*
+ * Decode the slice of each address from the counts, return -1 if the counts
+ * are not close enough to a valid assignment
+ */
+static int decode_batch(const uint64_t *counts, int n, int *slices) {
+    int i, k;
+    int full = (1 << n) - 1;
+    int seen = 0;
+    uint64_t baseline = counts[0];
+    uint64_t excess = 0;
+
+    for (i = 1; i < nb_counts; i++) {
+        baseline = MIN(baseline, counts[i]);
+    }
+    for (i = 0; i < nb_counts; i++) {
+        excess += counts[i] - baseline;
+    }
+    if (excess == 0) {
+        return -1;
     }
 
-    // Enable counting
-    val[0] = val_enable_counting;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctl0[i], 1, val);
+    // Lookups of one base chunk of pokes
+    double unit = (double)excess / full;
+
+    for (k = 0; k < n; k++) {
+        slices[k] = -1;
     }
+    for (i = 0; i < nb_counts; i++) {
+        double m = (counts[i] - baseline) / unit;
+        int r = (int)(m + 0.5);
+        if (r < 0 || r > full || (r & seen) || m - r > 0.25 || r - m > 0.25) {
+            return -1;
+        }
+        seen |= r;
+        for (k = 0; k < n; k++) {
+            if (r & (1 << k)) {
+                slices[k] = i;
+            }
+        }
+    }
+    return seen == full ? 0 : -1;
+}
 
-    // Select event to monitor: umask and filter
-    val[0] = val_select_event;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_ctl0[i], 1, val);
+// Probe up to monitor_batch_size() addresses in one counter window
+static int probe_window(const uintptr_t *addrs, int n, probe_result_t *res) {
+    int k;
+    int slices[MAX_BATCH];
+    uint64_t *counts = scratch_counts;
+
+    if (n == 1) {
+        return monitor_probe(addrs[0], &res[0]);
     }
-    val[0] = val_filter;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_filter[i], 1, val);
+
+    // The most poked address gets nb_pokes, as in a single probe
+    int base = MAX(1, nb_pokes >> (n - 1));
+
+    if (monitoring_delta) {
+        if (backend->read(scratch_before) < 0) {
+            return -1;
+        }
+    } else if (backend->start() < 0) {
+        return -1;
+    }
+    for (k = 0; k < n; k++) {
+        res[k].paddr = poke_n(addrs[k], base << k);
+        res[k].pokes = base << k;
     }
+    if (!monitoring_delta && backend->stop() < 0) {
+        return -1;
+    }
+    if (read_counts(counts) < 0) {
+        return -1;
+    }
+    nb_batches++;
 
-    // Unfreezing box counters
-    val[0] = val_box_unfreeze;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+    if (decode_batch(counts, n, slices) < 0) {
+        // Ambiguous: measure the addresses one by one
+        nb_batch_fallbacks++;
+        for (k = 0; k < n; k++) {
+            if (monitor_probe(addrs[k], &res[k]) < 0) {
+                return -1;
+            }
+        }
+        return 0;
     }
 
-    // Launch program to monitor
-    poke(addr);
+    for (k = 0; k < n; k++) {
+        res[k].slice = slices[k];
+        res[k].second = -1;
+        res[k].margin = 0;
+        res[k].counts = counts;
+        res[k].nb_counts = nb_counts;
+        res[k].batch = n;
+        total_pokes += res[k].pokes;
+    }
+    nb_probes += n;
 
-    // Freeze box counters
-    val[0] = val_box_freeze;
-    for (i = 0; i < nb_cores; i++) {
-        wrmsr_on_cpu_0(msr_pmon_box_ctl[i], 1, val);
+    return 0;
+}
+
+int monitor_probe_batch(const uintptr_t *addrs, int n, probe_result_t *res) {
+    int k, size;
+    int batch = monitor_batch_size();
+
+    if (backend != NULL && backend->probe != NULL) {
+        for (k = 0; k < n; k++) {
+            if (probe_one(addrs[k], k + 1 < n ? addrs[k + 1] : 0, &res[k]) <
+                0) {
+                return -1;
+            }
+        }
+        return 0;
     }
 
-    // Read counters
-    //
-    int *cboxes = calloc(max_slices, sizeof(int));
-    int *cboxes_tri = calloc(max_slices, sizeof(int));
-    for (i = 0; i < nb_cores; i++) {
-        cboxes[i] = rdmsr_on_cpu_0(msr_pmon_ctr0[i]);
-        cboxes_tri[i] = rdmsr_on_cpu_0(msr_pmon_ctr0[i]);
-    }
-
-    // Interpreting the results
-    //
-
-    // Finding the slice in which the address is
-    int slice = 0;
-    for (i = 0; i < max_slices; i++) {
-        if (cboxes[i] > cboxes[slice]) {
-            slice = i;
+    for (k = 0; k < n; k += size) {
+        size = MIN(batch, n - k);
+        if (probe_window(&addrs[k], size, &res[k]) < 0) {
+            return -1;
         }
     }
+    return 0;
+}
 
-    free(cboxes);
-    free(cboxes_tri);
+void monitor_print(const probe_result_t *res) {
+    int i;
+
+    print_bin(res->paddr);
+    if (backend->probe != NULL || res->batch > 1) {
+        printf(" %d\n", res->slice);
+        return;
+    }
 
-    return slice;
+    // Each poke also adds lookups to every slice: only keep the extra ones
+    long long first = MAX((long long)res->counts[res->slice] - res->pokes, 0);
+    long long second = 0;
+    if (res->second >= 0) {
+        second = MAX((long long)res->counts[res->second] - res->pokes, 0);
+    }
+
+    // Ratio between the first and the second result to estimate the error
+    float percent = first > 0 ? ((float)second) / ((float)first) * 100 : 0;
+    printf(" %d %6.2f", res->slice, percent);
+    for (i = 0; i < res->nb_counts; i++) {
+        printf(" % 6lld", MAX((long long)res->counts[i] - res->pokes, 0));
+    }
+    if (adaptive_margin > 0) {
+        printf(" %7d", res->pokes);
+    }
+    printf("\n");
+}
+
+void monitor_disarm(void) {
+    if (backend == NULL) {
+        return;
+    }
+
+    if (monitoring_delta) {
+        backend->stop();
+    }
+    backend->disarm();
+    free_scratch();
+
+    double elapsed = elapsed_since(&arm_time);
+    fprintf(stderr, "%llu probes in %.2f s (%.1f probes/s)\n", nb_probes,
+            elapsed, elapsed > 0 ? nb_probes / elapsed : 0);
+    if (adaptive_margin > 0 && nb_probes > 0) {
+        fprintf(stderr, "%.0f pokes per probe on average (cap %d)\n",
+                (double)total_pokes / nb_probes, nb_pokes);
+    }
+    if (nb_batches > 0) {
+        fprintf(stderr, "%llu multiplexed batches, %llu decoded\n",
+                nb_batches, nb_batches - nb_batch_fallbacks);
+    }
 }
@@ -21,8 +21,41 @@
  * ----------------------------------------------------------------------- */
 
 
-int monitor_single_address_clflush(uintptr_t addr, int print);
-int monitor_single_address_core(uintptr_t addr, int print);
-int monitor_single_address_fast(uintptr_t addr);
-int monitor_single_address_print(uintptr_t addr);
-int monitor_single_address(uintptr_t addr);
+#ifndef SLICE_REVERSE_MONITORING_H
+#define SLICE_REVERSE_MONITORING_H
+
+#include <stdint.h>
+
+// Maximum number of addresses poked in the same counter window, or handed to
+// the clflush pipeline at once
+#define MAX_BATCH 4
+
+extern int monitoring_perf;
+extern int monitoring_clflush;
+extern int monitoring_delta;
+extern int monitoring_batch;
+extern double adaptive_margin;
+extern int adaptive_chunk;
+
+/*
+ * Result of probing one address
+ */
+typedef struct {
+    int slice;        // slice with the highest count
+    int second;       // runner-up slice, -1 if there is a single slice
+    uint64_t margin;  // count of the slice minus count of the runner-up
+    uintptr_t paddr;  // physical address of the probed address
+    int pokes;        // number of pokes used (0 for clflush)
+    int batch;        // number of addresses measured in the same window
+    int nb_counts;
+    uint64_t *counts; // raw count per slice, valid until the next probe
+} probe_result_t;
+
+int monitor_arm(void);
+int monitor_probe(uintptr_t addr, probe_result_t *res);
+int monitor_batch_size(void);
+int monitor_probe_batch(const uintptr_t *addrs, int n, probe_result_t *res);
+void monitor_print(const probe_result_t *res);
+void monitor_disarm(void);
+
+#endif // SLICE_REVERSE_MONITORING_H
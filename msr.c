@@ -0,0 +1,148 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "msr.h"
+
+/*
+ * Session shared by the whole program, see msr_shared_session()
+ */
+static msr_session_t shared;
+
+static void close_shared(void) {
+    msr_session_close(&shared);
+}
+
+int msr_session_open(msr_session_t *session) {
+    int i;
+    long nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (nb_cpus <= 0) {
+        return -EINVAL;
+    }
+
+    session->fds = (int *)malloc(nb_cpus * sizeof(int));
+    if (session->fds == NULL) {
+        return -ENOMEM;
+    }
+    for (i = 0; i < nb_cpus; i++) {
+        session->fds[i] = -1;
+    }
+    session->nb_cpus = nb_cpus;
+
+    return 0;
+}
+
+void msr_session_close(msr_session_t *session) {
+    int i;
+
+    if (session->fds == NULL) {
+        return;
+    }
+    for (i = 0; i < session->nb_cpus; i++) {
+        if (session->fds[i] >= 0) {
+            close(session->fds[i]);
+        }
+    }
+    free(session->fds);
+    session->fds = NULL;
+    session->nb_cpus = 0;
+}
+
+int msr_shared_session(msr_session_t **session) {
+    static int registered = 0;
+    int ret;
+
+    if (shared.fds == NULL) {
+        ret = msr_session_open(&shared);
+        if (ret < 0) {
+            return ret;
+        }
+        if (!registered) {
+            atexit(close_shared);
+            registered = 1;
+        }
+    }
+    *session = &shared;
+
+    return 0;
+}
+
+/*
+ * Return the file descriptor of the msr device of a CPU, opening it on first
+ * use. The device is opened read-write once, for both reads and writes.
+ */
+static int msr_fd(msr_session_t *session, int cpu) {
+    char msr_file_name[64];
+    int fd;
+
+    if (cpu < 0 || cpu >= session->nb_cpus) {
+        return -ENXIO;
+    }
+    if (session->fds[cpu] >= 0) {
+        return session->fds[cpu];
+    }
+
+    sprintf(msr_file_name, "/dev/cpu/%d/msr", cpu);
+    fd = open(msr_file_name, O_RDWR);
+    if (fd < 0) {
+        return -errno;
+    }
+    session->fds[cpu] = fd;
+
+    return fd;
+}
+
+int msr_read(msr_session_t *session, int cpu, uint32_t reg, uint64_t *data) {
+    int fd = msr_fd(session, cpu);
+
+    if (fd < 0) {
+        return fd;
+    }
+    errno = 0;
+    if (pread(fd, data, sizeof *data, reg) != sizeof *data) {
+        return errno ? -errno : -EIO;
+    }
+
+    return 0;
+}
+
+int msr_write(msr_session_t *session, int cpu, uint32_t reg, uint64_t data) {
+    int fd = msr_fd(session, cpu);
+
+    if (fd < 0) {
+        return fd;
+    }
+    errno = 0;
+    if (pwrite(fd, &data, sizeof data, reg) != sizeof data) {
+        return errno ? -errno : -EIO;
+    }
+
+    return 0;
+}
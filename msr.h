@@ -0,0 +1,53 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_MSR_H
+#define SLICE_REVERSE_MSR_H
+
+#include <stdint.h>
+
+/*
+ * A set of /dev/cpu/N/msr file descriptors, opened the first time a CPU is
+ * accessed and kept until the session is closed.
+ */
+typedef struct {
+    int nb_cpus;
+    int *fds; // -1 while the CPU has not been accessed yet
+} msr_session_t;
+
+/*
+ * All functions return 0 on success and a negative errno value on failure.
+ * They never exit the program: the caller decides what to do with the error.
+ */
+int msr_session_open(msr_session_t *session);
+void msr_session_close(msr_session_t *session);
+
+/*
+ * The session used by every part of the program (rdmsr, wrmsr and the
+ * monitoring), so that each msr device is opened once. It is opened on first
+ * use and closed at exit.
+ */
+int msr_shared_session(msr_session_t **session);
+int msr_read(msr_session_t *session, int cpu, uint32_t reg, uint64_t *data);
+int msr_write(msr_session_t *session, int cpu, uint32_t reg, uint64_t data);
+
+#endif // SLICE_REVERSE_MSR_H
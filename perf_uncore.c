@@ -0,0 +1,243 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf_uncore.h"
+
+#define PMU_PATH "/sys/bus/event_source/devices"
+
+#define LLC_LOOKUP_EVENT 0x34
+#define UMASK_CLIENT_ANY 0x8f // any request, client CBoxes
+#define UMASK_SERVER_ANY 0x11 // any request, cache states set in the filter
+
+// Client and older Xeon parts expose CBoxes, Skylake SP and later CHAs
+static const char *const pmu_prefixes[] = {"uncore_cbox", "uncore_cha"};
+
+static long perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+                            int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/*
+ * Return the perf type of the PMU of a box, or -1 if there is no such box
+ */
+static int pmu_type(const char *prefix, int box) {
+    char path[128];
+    int type = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), PMU_PATH "/%s_%d/type", prefix, box);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    if (fscanf(f, "%d", &type) != 1) {
+        type = -1;
+    }
+    fclose(f);
+
+    return type;
+}
+
+static const char *pmu_prefix(void) {
+    unsigned int i;
+
+    for (i = 0; i < sizeof(pmu_prefixes) / sizeof(pmu_prefixes[0]); i++) {
+        if (pmu_type(pmu_prefixes[i], 0) >= 0) {
+            return pmu_prefixes[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Number of CBo/CHA PMUs exported by the kernel
+ */
+int perf_uncore_count_boxes(void) {
+    const char *prefix = pmu_prefix();
+    int n = 0;
+
+    if (prefix == NULL) {
+        return 0;
+    }
+    while (pmu_type(prefix, n) >= 0) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Bits of a field of the events of a PMU, from its format file (eg
+ * "config1:18-22"). Returns 0 and leaves mask alone if the PMU has no such
+ * field.
+ */
+static int pmu_field(const char *prefix, const char *field, const char *reg,
+                     uint64_t *mask) {
+    char path[160], name[16];
+    int lo, hi, n;
+    FILE *f;
+
+    snprintf(path, sizeof(path), PMU_PATH "/%s_0/format/%s", prefix, field);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    n = fscanf(f, "%15[^:]:%d-%d", name, &lo, &hi);
+    fclose(f);
+    if (n < 2 || strcmp(name, reg) != 0 || lo < 0 || lo > 63) {
+        return -EINVAL;
+    }
+    if (n == 2 || hi < lo || hi > 63) {
+        hi = lo;
+    }
+    *mask = (hi == 63 ? ~0ULL : (1ULL << (hi + 1)) - 1) & ~((1ULL << lo) - 1);
+    return 1;
+}
+
+int perf_uncore_llc_event(uint64_t *config, uint64_t *config1) {
+    const char *prefix = pmu_prefix();
+    uint64_t states = 0;
+    int ret;
+
+    if (prefix == NULL) {
+        return -ENOENT;
+    }
+    ret = pmu_field(prefix, "filter_state", "config1", &states);
+    if (ret < 0) {
+        return ret;
+    }
+    if (ret == 0) {
+        // Client CBoxes: no filter, the umask selects every request
+        *config = LLC_LOOKUP_EVENT | UMASK_CLIENT_ANY << 8;
+        *config1 = 0;
+    } else {
+        // Server CBoxes and CHAs: lookups in any of the states of the filter
+        *config = LLC_LOOKUP_EVENT | UMASK_SERVER_ANY << 8;
+        *config1 = states;
+    }
+    return 0;
+}
+
+int perf_uncore_open(perf_uncore_t *pu, int nb_boxes, int cpu,
+                     uint64_t config, uint64_t config1) {
+    const char *prefix = pmu_prefix();
+    struct perf_event_attr attr;
+    int i, err;
+
+    if (prefix == NULL) {
+        return -ENOENT;
+    }
+    if (perf_uncore_count_boxes() < nb_boxes) {
+        return -ENODEV;
+    }
+
+    pu->nb_boxes = nb_boxes;
+    pu->fds = (int *)malloc(nb_boxes * sizeof(int));
+    if (pu->fds == NULL) {
+        pu->nb_boxes = 0;
+        return -ENOMEM;
+    }
+    for (i = 0; i < nb_boxes; i++) {
+        pu->fds[i] = -1;
+    }
+
+    for (i = 0; i < nb_boxes; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = pmu_type(prefix, i);
+        attr.config = config;
+        attr.config1 = config1;
+        attr.disabled = 1;
+
+        // Uncore events are per package: no task, any CPU of the package
+        pu->fds[i] = perf_event_open(&attr, -1, cpu, -1, 0);
+        if (pu->fds[i] < 0) {
+            err = errno;
+            perf_uncore_close(pu);
+            return -err;
+        }
+    }
+
+    return 0;
+}
+
+void perf_uncore_close(perf_uncore_t *pu) {
+    int i;
+
+    if (pu->fds != NULL) {
+        for (i = 0; i < pu->nb_boxes; i++) {
+            if (pu->fds[i] >= 0) {
+                close(pu->fds[i]);
+            }
+        }
+    }
+    free(pu->fds);
+    pu->fds = NULL;
+    pu->nb_boxes = 0;
+}
+
+static int perf_uncore_ioctl(perf_uncore_t *pu, unsigned long request) {
+    int i;
+
+    for (i = 0; i < pu->nb_boxes; i++) {
+        if (ioctl(pu->fds[i], request, 0) < 0) {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+int perf_uncore_reset(perf_uncore_t *pu) {
+    return perf_uncore_ioctl(pu, PERF_EVENT_IOC_RESET);
+}
+
+int perf_uncore_enable(perf_uncore_t *pu) {
+    return perf_uncore_ioctl(pu, PERF_EVENT_IOC_ENABLE);
+}
+
+int perf_uncore_disable(perf_uncore_t *pu) {
+    return perf_uncore_ioctl(pu, PERF_EVENT_IOC_DISABLE);
+}
+
+int perf_uncore_read(perf_uncore_t *pu, uint64_t *counts) {
+    int i;
+
+    for (i = 0; i < pu->nb_boxes; i++) {
+        errno = 0;
+        if (read(pu->fds[i], &counts[i], sizeof(uint64_t)) !=
+            sizeof(uint64_t)) {
+            return errno ? -errno : -EIO;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_PERF_UNCORE_H
+#define SLICE_REVERSE_PERF_UNCORE_H
+
+#include <stdint.h>
+
+/*
+ * One counter per CBo (or CHA), opened through the kernel uncore PMUs
+ * (uncore_cbox_N or uncore_cha_N) instead of raw MSR accesses.
+ *
+ * Each box is its own PMU, and the kernel does not group events of several
+ * PMUs, so the counters are opened, started and read one by one.
+ */
+typedef struct {
+    int nb_boxes;
+    int *fds;
+} perf_uncore_t;
+
+int perf_uncore_count_boxes(void);
+
+/*
+ * Config and config1 of the LLC lookup event that counts every request of a
+ * box, for the PMUs of this machine: the event is the same on all the CBoxes
+ * and CHAs, the umask and the cache state filter are chosen from the event
+ * format the PMU exports, without a table of CPU models.
+ */
+int perf_uncore_llc_event(uint64_t *config, uint64_t *config1);
+
+int perf_uncore_open(perf_uncore_t *pu, int nb_boxes, int cpu,
+                     uint64_t config, uint64_t config1);
+void perf_uncore_close(perf_uncore_t *pu);
+int perf_uncore_reset(perf_uncore_t *pu);
+int perf_uncore_enable(perf_uncore_t *pu);
+int perf_uncore_disable(perf_uncore_t *pu);
+int perf_uncore_read(perf_uncore_t *pu, uint64_t *counts);
+
+#endif // SLICE_REVERSE_PERF_UNCORE_H
@@ -22,3 +22,4 @@
 
 
 uintptr_t poke(uintptr_t addr);
+uintptr_t poke_n(uintptr_t addr, int n);
@@ -0,0 +1,136 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "populate.h"
+#include "topology.h"
+#include "translate.h"
+
+typedef struct {
+    pthread_t thread;
+    char *mem;
+    size_t first;        // first page of the share of the worker
+    size_t nb;           // pages in the share
+    int page_shift;
+    atomic_size_t done;  // pages of the share touched so far
+    size_t translated;   // pages of the share whose frame is read
+} populate_worker_t;
+
+static void *populate_worker(void *arg) {
+    populate_worker_t *w = (populate_worker_t *)arg;
+    size_t i;
+
+    for (i = 0; i < w->nb; i++) {
+        ((volatile char *)w->mem)[(w->first + i) << w->page_shift] = 12;
+        atomic_store_explicit(&w->done, i + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+int populate(char *mem, size_t len, int page_shift, int package) {
+    size_t nb_pages = (len + (1UL << page_shift) - 1) >> page_shift;
+    int nb_workers = topology_nb_cores(package);
+    populate_worker_t *workers;
+    pthread_attr_t attr;
+    cpu_set_t my_set;
+    size_t done, left;
+    int i, cpu, ret, started = 0;
+
+    if (nb_workers < 1) {
+        nb_workers = 1;
+    }
+    if ((size_t)nb_workers > nb_pages) {
+        nb_workers = nb_pages;
+    }
+    ret = translate_map_lazy(mem, len, page_shift);
+    if (ret < 0) {
+        return ret;
+    }
+    workers = (populate_worker_t *)calloc(nb_workers, sizeof(*workers));
+    if (workers == NULL) {
+        translate_unmap(mem);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < nb_workers; i++) {
+        populate_worker_t *w = &workers[i];
+
+        w->mem = mem;
+        w->first = nb_pages * i / nb_workers;
+        w->nb = nb_pages * (i + 1) / nb_workers - w->first;
+        w->page_shift = page_shift;
+        atomic_init(&w->done, 0);
+
+        pthread_attr_init(&attr);
+        cpu = topology_core_cpu(package, i);
+        if (cpu >= 0) {
+            CPU_ZERO(&my_set);
+            CPU_SET(cpu, &my_set);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &my_set);
+        }
+        ret = -pthread_create(&w->thread, &attr, populate_worker, w);
+        pthread_attr_destroy(&attr);
+        if (ret < 0) {
+            break;
+        }
+        started++;
+    }
+
+    // Read the frames of the pages faulted in so far, until all are
+    if (started == nb_workers) {
+        do {
+            left = 0;
+            for (i = 0; i < nb_workers && ret == 0; i++) {
+                populate_worker_t *w = &workers[i];
+
+                done = atomic_load_explicit(&w->done, memory_order_acquire);
+                if (done > w->translated) {
+                    ret = translate_map_pages(mem, w->first + w->translated,
+                                              done - w->translated);
+                    w->translated = done;
+                }
+                left += w->nb - w->translated;
+            }
+            if (left > 0 && ret == 0) {
+                sched_yield();
+            }
+        } while (left > 0 && ret == 0);
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    if (ret < 0) {
+        translate_unmap(mem);
+    }
+
+    return ret;
+}
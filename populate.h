@@ -0,0 +1,44 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#ifndef SLICE_REVERSE_POPULATE_H
+#define SLICE_REVERSE_POPULATE_H
+
+#include <stddef.h>
+
+/*
+ * Fault in a fresh mapping of 2M or 1G pages (mapped without MAP_POPULATE)
+ * and read the frames of its pages, see translate_map().
+ *
+ * One worker thread per core of the package, pinned to the first thread of
+ * its core, writes one byte to each page of its share: the kernel clears a
+ * huge page on its first touch, so the clearing runs on all the cores at once,
+ * and the pages come from the node of the package (first-touch policy). The
+ * calling thread reads the frames of the pages from pagemap as the workers
+ * fault them in.
+ *
+ * Returns 0 or a negative errno value.
+ */
+int populate(char *mem, size_t len, int page_shift, int package);
+
+#endif // SLICE_REVERSE_POPULATE_H
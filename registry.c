@@ -0,0 +1,184 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+
+#include "model.h"
+#include "registry.h"
+
+/*
+ * Read the "cpu" line of the next entry, skipping comments and blank lines.
+ * Returns 1 with the signature, 0 at the end of the file.
+ */
+static int read_signature(FILE *f, unsigned int *signature) {
+    char line[256], *token, *save, *end;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "#\n")] = '\0';
+        token = strtok_r(line, " \t", &save);
+        if (token == NULL) {
+            continue;
+        }
+        if (strcmp(token, "cpu") != 0) {
+            return -EINVAL;
+        }
+        token = strtok_r(NULL, " \t", &save);
+        if (token == NULL) {
+            return -EINVAL;
+        }
+        *signature = strtoul(token, &end, 16);
+        if (*end != '\0' || strtok_r(NULL, " \t", &save) != NULL) {
+            return -EINVAL;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Read every entry of an open registry file
+ */
+static int load_entries(registry_t *registry, FILE *f) {
+    registry_entry_t *entries;
+    unsigned int signature;
+    int ret;
+
+    registry->nb_entries = 0;
+    registry->entries = NULL;
+    while ((ret = read_signature(f, &signature)) > 0) {
+        entries = (registry_entry_t *)realloc(
+            registry->entries,
+            (registry->nb_entries + 1) * sizeof(registry_entry_t));
+        if (entries == NULL) {
+            ret = -ENOMEM;
+            break;
+        }
+        registry->entries = entries;
+        entries[registry->nb_entries].signature = signature;
+        ret = model_read(&entries[registry->nb_entries].model, f);
+        if (ret < 0) {
+            ret = -EINVAL; // an entry without its function
+            break;
+        }
+        registry->nb_entries++;
+    }
+
+    if (ret < 0) {
+        registry_free(registry);
+    }
+    return ret;
+}
+
+int registry_load(registry_t *registry, const char *path) {
+    int ret;
+    FILE *f;
+
+    registry->nb_entries = 0;
+    registry->entries = NULL;
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -errno;
+    }
+    ret = load_entries(registry, f);
+    fclose(f);
+
+    return ret;
+}
+
+void registry_free(registry_t *registry) {
+    int i;
+
+    for (i = 0; i < registry->nb_entries; i++) {
+        model_free(&registry->entries[i].model);
+    }
+    free(registry->entries);
+    registry->entries = NULL;
+    registry->nb_entries = 0;
+}
+
+const model_t *registry_find(const registry_t *registry,
+                             unsigned int signature, int nb_slices) {
+    int i;
+
+    for (i = registry->nb_entries - 1; i >= 0; i--) {
+        if (registry->entries[i].signature == signature &&
+            registry->entries[i].model.nb_slices == nb_slices) {
+            return &registry->entries[i].model;
+        }
+    }
+    return NULL;
+}
+
+static int same_model(const model_t *a, const model_t *b) {
+    return a->nb_slices == b->nb_slices && a->nb_bits == b->nb_bits &&
+           memcmp(a->masks, b->masks, a->nb_bits * sizeof(uint64_t)) == 0 &&
+           memcmp(a->table, b->table, 1 << a->nb_bits) == 0;
+}
+
+int registry_add(const char *path, unsigned int signature,
+                 const model_t *model) {
+    registry_t registry;
+    const model_t *known;
+    int ret;
+    FILE *f;
+
+    // Reads start at the beginning, writes always go to the end
+    f = fopen(path, "a+");
+    if (f == NULL) {
+        return -errno;
+    }
+    if (flock(fileno(f), LOCK_EX) < 0) {
+        ret = -errno;
+        fclose(f);
+        return ret;
+    }
+
+    // Under the lock, so that two runs do not both append the function
+    rewind(f);
+    ret = load_entries(&registry, f);
+    if (ret < 0) {
+        fclose(f);
+        return ret;
+    }
+    known = registry_find(&registry, signature, model->nb_slices);
+    ret = known != NULL && same_model(known, model);
+    registry_free(&registry);
+    if (ret) {
+        fclose(f);
+        return 1;
+    }
+
+    fprintf(f, "cpu 0x%x\n", signature);
+    ret = model_write(model, f);
+    if (fflush(f) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    // Closing the file releases the lock
+    if (fclose(f) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    return ret;
+}
@@ -0,0 +1,63 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_REGISTRY_H
+#define SLICE_REVERSE_REGISTRY_H
+
+#include "model.h"
+
+/*
+ * Known slice functions, keyed by CPU signature (CPUID.1 EAX: family, model
+ * and stepping) and number of slices.
+ *
+ * Text file format, '#' starts a comment: each entry is a line
+ *   cpu <hexadecimal signature>
+ * followed by the function in the model format of model.h. When a CPU and a
+ * slice count appear several times, the last entry wins, so that appending
+ * a function supersedes the previous one.
+ */
+typedef struct {
+    unsigned int signature;
+    model_t model;
+} registry_entry_t;
+
+typedef struct {
+    int nb_entries;
+    registry_entry_t *entries;
+} registry_t;
+
+int registry_load(registry_t *registry, const char *path);
+void registry_free(registry_t *registry);
+const model_t *registry_find(const registry_t *registry,
+                             unsigned int signature, int nb_slices);
+
+/*
+ * Append an entry to a registry file, created if needed, unless the entry
+ * that wins for this CPU and slice count is already the same function.
+ * Returns 0 once appended, 1 if already known, or a negative errno value. The
+ * file is locked while checking and writing, so that concurrent runs (one per
+ * package) do not interleave.
+ */
+int registry_add(const char *path, unsigned int signature,
+                 const model_t *model);
+
+#endif // SLICE_REVERSE_REGISTRY_H
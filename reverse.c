@@ -22,6 +22,8 @@
 
 
 #define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
 #include <getopt.h>
 #include <math.h>
 #include <sched.h>
@@ -30,22 +32,41 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "arch.h"
+#include "checkpoint.h"
+#include "decode.h"
+#include "gf2.h"
+#include "hugepool.h"
+#include "hugetlb.h"
 #include "cpuid.h"
 #include "global_variables.h"
+#include "line_cache.h"
+#include "model.h"
 #include "monitoring.h"
+#include "perf_uncore.h"
 #include "poke.h"
+#include "populate.h"
 #include "rdmsr.h"
+#include "registry.h"
 #include "reverse.h"
+#include "sockets.h"
+#include "topology.h"
+#include "translate.h"
 #include "util.h"
 #include "wrmsr.h"
 
-#define HUGE_PAGE_SIZE (1 * 1024 * 1024 * 1024)
-#define HUGE_PAGE_SIZE_2M (2 * 1024 * 1024)
-#define ADDR_PER_BIT 500
-#define THRESHOLD 200
+#define ADDR_PER_BIT 500     // most pairs probed for an ambiguous bit
+#define ADDR_PER_BIT_XEON 100
+#define FIRST_SAMPLES 8      // pairs probed for every bit before deciding
+#define CHECKPOINT_PERIOD 10 // seconds between checkpoints while sampling a bit
+#define VALIDATE_REGION 30   // validation failures are grouped by 1G region
+#define VALIDATE_FLAG 0.05   // regions with more failures than this are flagged
+#define VALIDATE_PAGE 16     // lines validated per huge page mapped
+#define SPOT_CHECK_LINES 48  // lines measured to accept a known function
+#define SPOT_CHECK_ERRORS 2  // mispredictions tolerated among them (noise)
 #define DEBUG 1
 
 void print_help() {
@@ -53,17 +74,51 @@ void print_help() {
 Options:\n\
 --help -h      prints this help\n\
 --clflush -f   does not use performance counters but clflush method\n\
---scan -s      does not reverse-engineer the function but finds the slice for a few addresses\n");
+--scan -s      does not reverse-engineer the function but finds the slice for a few addresses\n\
+--cpu -c N     runs on CPU N and drives the uncore from it (default 0)\n\
+--perf -p      reads the uncore through perf_event_open instead of the msr module\n\
+--adaptive -a Z  stops poking an address once its slice leads by Z standard deviations\n\
+--delta -d     leaves the counters running and samples them before and after each poke\n\
+--batch -b     pokes several addresses in the same counter window\n\
+--linear -l    solves the hash as a linear system from random addresses\n\
+--error -e E   stops sampling a bit once its decision is wrong with probability below E (default 1e-4)\n\
+--nonlinear -n FILE  learns a pre-hash and a table, for any number of slices, and writes them to FILE\n\
+--all-sockets -A  studies every package at once, each from its first CPU, and reports one function per package\n\
+--checkpoint -k FILE  saves the progress of the run to FILE as it goes\n\
+--resume -r    continues the run saved in the checkpoint FILE\n\
+--validate -V N  checks the function found against the measured slices of N random lines\n\
+--registry -R FILE  spot-checks the function FILE knows for this CPU instead of reversing it,\n\
+               and adds the functions found to FILE\n");
 }
 
 /*
  * Declare global variables
  */
 
-int clflush = 0;
 int scan = 0;
+int linear = 0;
+char *nonlinear = NULL;
+int all_sockets = 0;
 int verbose = 0;
 
+// For the summary of the reverse functions
+static long nb_pairs = 0;
+static struct timespec reverse_start;
+static double populate_time = 0; // seconds spent faulting in the huge pages
+
+// Slices measured so far, shared by all the bits
+static line_cache_t measured;
+
+// Progress of the run, saved to checkpoint_file when there is one
+enum { RUN_CORE, RUN_XEON, RUN_GENERIC };
+static const char *run_names[] = {"core", "xeon", "generic"};
+static char *checkpoint_file = NULL;
+static long validate = 0; // random lines checked against the function found
+static char *registry_file = NULL;
+static int resume = 0;
+static checkpoint_t progress;
+static struct timespec last_checkpoint;
+
 int main(int argc, char **argv) {
 
     /*
@@ -74,46 +129,93 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    /*
-     * Pin to core
-     */
-    int cpu_mask = 0;
-    cpu_set_t my_set;
-    CPU_ZERO(&my_set);
-    CPU_SET(cpu_mask, &my_set);
-    sched_setaffinity(0, sizeof(cpu_set_t), &my_set);
-
-    /*
-     * Extract CPU information: micro-arch name and number of cores
-     * https://en.wikichip.org/wiki/intel/cpuid
-     */
-    nb_cores = cores_per_package();
-    int cpu_model = get_cpu_model();
-
-
     /*
      * Options
      */
     int opt;
+    int cpu_mask = 0;
 
-    static struct option long_options[] = {{"help", no_argument, NULL, 'h'},
-                                           {"clflush", no_argument, NULL, 'f'},
-                                           {"scan", no_argument, NULL, 's'},
-                                           {"verbose", no_argument, NULL, 'v'},
-                                           {NULL, 0, NULL, 0}};
-
-    while ((opt = getopt_long(argc, argv, "hfsv", long_options, NULL)) != -1) {
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"clflush", no_argument, NULL, 'f'},
+        {"scan", no_argument, NULL, 's'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"cpu", required_argument, NULL, 'c'},
+        {"perf", no_argument, NULL, 'p'},
+        {"adaptive", required_argument, NULL, 'a'},
+        {"delta", no_argument, NULL, 'd'},
+        {"batch", no_argument, NULL, 'b'},
+        {"linear", no_argument, NULL, 'l'},
+        {"error", required_argument, NULL, 'e'},
+        {"nonlinear", required_argument, NULL, 'n'},
+        {"all-sockets", no_argument, NULL, 'A'},
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"resume", no_argument, NULL, 'r'},
+        {"validate", required_argument, NULL, 'V'},
+        {"registry", required_argument, NULL, 'R'},
+        {NULL, 0, NULL, 0}};
+
+    while ((opt = getopt_long(argc, argv, "hfsvc:pa:dble:n:Ak:rV:R:",
+                              long_options, NULL)) != -1) {
         // check to see if a single character or long option came through
         switch (opt) {
         case 'h':
             print_help();
             exit(0);
+        case 'c':
+            cpu_mask = atoi(optarg);
+            break;
+        case 'p':
+            monitoring_perf = 1;
+            break;
+        case 'a':
+            adaptive_margin = atof(optarg);
+            break;
+        case 'd':
+            monitoring_delta = 1;
+            break;
+        case 'b':
+            monitoring_batch = 1;
+            break;
+        case 'l':
+            linear = 1;
+            break;
+        case 'n':
+            nonlinear = optarg;
+            break;
+        case 'e':
+            if (atof(optarg) <= 0 || atof(optarg) >= 0.5) {
+                fprintf(stderr, "The error must be in ]0, 0.5[\n");
+                exit(EXIT_FAILURE);
+            }
+            decode_set_error(atof(optarg));
+            break;
         case 'f':
-            clflush = 1;
+            monitoring_clflush = 1;
             break;
         case 's':
             scan = 1;
             break;
+        case 'A':
+            all_sockets = 1;
+            break;
+        case 'k':
+            checkpoint_file = optarg;
+            break;
+        case 'r':
+            resume = 1;
+            break;
+        case 'V':
+            validate = atol(optarg);
+            if (validate < 1) {
+                fprintf(stderr, "The number of lines to validate must be "
+                                "positive\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            registry_file = optarg;
+            break;
         case 'v':
             verbose = 1;
             break;
@@ -123,56 +225,138 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (determine_class_uarch(cpu_model) < 0 && !clflush) {
+    if (resume && checkpoint_file == NULL) {
+        fprintf(stderr, "--resume needs the checkpoint FILE (-k)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (checkpoint_file != NULL && (scan || linear || nonlinear != NULL)) {
+        fprintf(stderr, "Only the bit by bit reverse can be checkpointed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /*
+     * Extract CPU information: micro-arch name and number of cores
+     * https://en.wikichip.org/wiki/intel/cpuid
+     */
+    if (topology_init() < 0) {
+        fprintf(stderr, "Cannot read the CPU topology\n");
         exit(EXIT_FAILURE);
     }
+
     /*
-     * Initialize architecture-dependent variables
+     * One context per package studied: the package of the CPU given with -c,
+     * or all of them, each driven from its first CPU
      */
+    int nb_sockets = all_sockets ? topology_nb_packages() : 1;
+    int i, n = 0;
+    socket_ctx_t *sockets =
+        (socket_ctx_t *)calloc(nb_sockets, sizeof(socket_ctx_t));
 
-    if (setup_perf_counters(class, archi, nb_cores) < 0 && !clflush) {
+    if (sockets == NULL) {
+        fprintf(stderr, "Cannot allocate the socket contexts\n");
         exit(EXIT_FAILURE);
     }
+    for (i = 0; i < nb_sockets; i++) {
+        int cpu = all_sockets ? topology_core_cpu(i, 0) : cpu_mask;
+        socket_ctx_t *ctx = &sockets[n];
+        int ret;
 
-    if (clflush) {
-        if (verbose) {
-            printf("Using clflush method\n");
+        if (cpu < 0) {
+            continue; // no online CPU in this package
+        }
+        ret = socket_ctx_init(ctx, cpu);
+        if (ret == -ENXIO) {
+            fprintf(stderr, "CPU %d is offline\n", cpu);
+            exit(EXIT_FAILURE);
         }
-        max_slices = 64; // A large number given there are no limits
+
+        /*
+         * Initialize architecture-dependent variables
+         */
+        if (ret < 0 && !monitoring_clflush && !monitoring_perf) {
+            exit(EXIT_FAILURE);
+        }
+
+        if (monitoring_clflush) {
+            if (verbose) {
+                printf("Using clflush method\n");
+            }
+            ctx->max_slices = 64; // A large number given there are no limits
+        } else if (monitoring_perf) {
+            // perf needs no MSR table: as many slices as exported boxes
+            ctx->max_slices = perf_uncore_count_boxes();
+        }
+
+        /*
+         * Verify number of cores is coherent with micro-architecture
+         */
+        if (ctx->nb_cores > ctx->max_slices) {
+            fprintf(
+                stderr,
+                "Specified number of cores (%d) incoherent with maximum number of "
+                "core of specified micro-architecure (%d for %s). \n",
+                ctx->nb_cores, ctx->max_slices, uarch_names[ctx->archi]);
+            print_help();
+            exit(1);
+        }
+        n++;
     }
+    nb_sockets = n;
 
-    /*
-     * Verify number of cores is coherent with micro-architecture
-     */
-    if (nb_cores > max_slices) {
-        fprintf(
-            stderr,
-            "Specified number of cores (%d) incoherent with maximum number of "
-            "core of specified micro-architecure (%d for %s). \n",
-            nb_cores, max_slices, uarch_names[archi]);
-        print_help();
-        exit(1);
+    if (sockets_run(sockets, nb_sockets, reverse_socket) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    free(sockets);
+
+    return 0;
+}
+
+/*
+ * Name of a file written by the run on this package: several packages run
+ * concurrently with -A, each with its own FILE.<package>
+ */
+static const char *socket_file(char *buf, size_t size, const char *path) {
+    if (all_sockets) {
+        snprintf(buf, size, "%s.%d", path, socket_ctx->package);
+    } else {
+        snprintf(buf, size, "%s", path);
     }
+    return buf;
+}
 
+/*
+ * Study the package of socket_ctx, from a CPU of that package
+ */
+void reverse_socket() {
     // Do we scan a few addresses or do we reverse-engineer the function
+    clock_gettime(CLOCK_MONOTONIC, &reverse_start);
+    if (line_cache_init(&measured, 4096) < 0) {
+        fprintf(stderr, "Cannot allocate the measurement cache\n");
+        exit(EXIT_FAILURE);
+    }
     if (scan) {
         if (verbose) {
             printf("Scanning a few addresses...\n");
         }
         scan_addresses();
+    } else if (registry_file != NULL && known_function()) {
+        // The known function holds: nothing to reverse
+    } else if (linear) {
+        reverse_linear();
+    } else if (nonlinear != NULL) {
+        char path[4096];
+
+        reverse_nonlinear(socket_file(path, sizeof(path), nonlinear));
     } else {
-        if (class == INTEL_CORE) {
-            // reverse_core();
-            reverse_generic();
-        } else if (class == INTEL_XEON) {
+        if (socket_ctx->class == INTEL_XEON) {
             reverse_xeon();
         } else {
-            fprintf(stderr,"Unsupported");
-            exit(EXIT_FAILURE);
+            // Core, or a model only known through its perf uncore PMUs
+            // reverse_core();
+            reverse_generic();
         }
     }
-
-    return 0;
+    line_cache_free(&measured);
 }
 
 void scan_addresses() {
@@ -182,586 +366,1274 @@ void scan_addresses() {
     for (i = 0; i < 64 * nb_addresses; i++)
         mem[i] = -1;
 
-    if (clflush) {
-        for (i = 0; i < nb_addresses; i++)
-            monitor_single_address_clflush((uintptr_t)mem + (i * 64), 1);
-    } else if (class == INTEL_CORE) {
-        if(verbose) {
-            printf("monitoring core\n");
+    uintptr_t addrs[nb_addresses];
+    probe_result_t res[nb_addresses];
+
+    if (verbose) {
+        printf("monitoring %s\n", classes_names[socket_ctx->class]);
+    }
+    if (monitor_arm() < 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nb_addresses; i++) {
+        addrs[i] = (uintptr_t)mem + (i * 64);
+    }
+    if (monitor_probe_batch(addrs, nb_addresses, res) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nb_addresses; i++) {
+        monitor_print(&res[i]);
+    }
+    monitor_disarm();
+}
+
+/*
+ * Fault in a fresh mapping of pages of 1 << page_shift bytes from the cores
+ * of the package and read its frames once, so that the translations below do
+ * not hit pagemap
+ */
+static void map_pages(char *mem, size_t len, int page_shift) {
+    struct timespec start, end;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = populate(mem, len, page_shift, socket_ctx->package);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot populate the huge pages: %s\n",
+                strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    populate_time += (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void unmap_pages(char *mem, size_t len) {
+    translate_unmap(mem);
+    munmap(mem, len);
+}
+
+/*
+ * NUMA node of a CPU, from the nodeN link in its sysfs directory, or -1
+ */
+static int cpu_node(int cpu) {
+    char path[64];
+    struct dirent *entry;
+    int node = -1;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
         }
-        for (i = 0; i < nb_addresses; i++)
-            monitor_single_address_core((uintptr_t)mem + (i * 64), 1);
-    } else {
-        for (i = 0; i < nb_addresses; i++)
-            monitor_single_address_fast((uintptr_t)mem + (i * 64));
     }
+    closedir(dir);
+
+    return node;
 }
 
-void reverse_core() {
-    register unsigned long long i;
-    int j, k;
-    unsigned long long offset1, offset2;
-    int slice1, slice2;
-    int nbits = ceil(log2(nb_cores));
-    int oj_a1, oj_a2;
-    int w[4][29] = {{0}};
+/*
+ * Node whose huge pages this run uses, -1 for all of them. When every
+ * package is studied at once, each one only takes the pages of its own node,
+ * so that the runs do not compete for the same pages and all the memory
+ * probed is local.
+ */
+static int hugepages_node(void) {
+    return all_sockets ? cpu_node(socket_ctx->cpu) : -1;
+}
 
-    /*
-     * Find the first 21 bits
-     */
-    // Allocate and initialize a huge page of 2MB
-    char *mem = (char *)mmap(
-        NULL, HUGE_PAGE_SIZE_2M, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+/*
+ * Size whose free pages span the most address bits, the larger size on a tie
+ * (sizes come largest first), and the end of the bits they reach: n pages
+ * span the bits [shift, shift + ceil(log2(n))) at best. Returns the index of
+ * the size, or -1 if no page is free.
+ */
+static int widest_size(const hugetlb_size_t *sizes, int nb_sizes,
+                       int *bit_end) {
+    int phys_bits = get_phys_address_bits();
+    int i, bit, best = -1;
+
+    *bit_end = 0;
+    for (i = 0; i < nb_sizes; i++) {
+        if (sizes[i].free < 1) {
+            continue;
+        }
+        bit = MIN((int)ceil(log2(sizes[i].free)) + sizes[i].shift, phys_bits);
+        if (bit > *bit_end) {
+            *bit_end = bit;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * Map the huge pages of the size that reaches the most address bits, just
+ * enough of them to span those bits, and translate them. Exits if no huge
+ * page is free.
+ */
+static char *map_widest(int *page_shift, long *nb_pages) {
+    hugetlb_size_t sizes[HUGETLB_MAX_SIZES];
+    int nb_sizes = hugetlb_sizes(sizes, HUGETLB_MAX_SIZES, hugepages_node());
+    int bit_end, best = widest_size(sizes, nb_sizes, &bit_end);
+    char *mem;
+
+    if (best < 0) {
+        fprintf(stderr, "No free huge page\n");
+        exit(EXIT_FAILURE);
+    }
+    *page_shift = sizes[best].shift;
+    *nb_pages = MIN(sizes[best].free, 1L << (bit_end - *page_shift));
+    mem = hugetlb_map(*nb_pages, *page_shift);
     if (mem == MAP_FAILED) {
-        printf("first mmap huge page has failed \n");
+        fprintf(stderr, "mmap huge pages has failed \n");
         exit(EXIT_FAILURE);
     }
-    for (i = 0; i < HUGE_PAGE_SIZE_2M; i++) {
-        mem[i] = 12;
+    map_pages(mem, (size_t)*nb_pages << *page_shift, *page_shift);
+    if (verbose) {
+        printf("Using %ld %luM pages, up to bit %d\n", *nb_pages,
+               1UL << (*page_shift - 20), bit_end - 1);
     }
 
-#if DEBUG
-    fprintf(stderr, "Progress: ");
-#endif // DEBUG
-    // Find the first 21 bits
-    for (i = 0; i < 15; i++) {
-        for (j = 0; j < 500; j++) {
-            offset1 = j << 6;
-            offset2 = offset1 ^ (1 << (i + 6));
-            if (clflush) {
-                slice1 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset1, 0);
-                slice2 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset2, 0);
-            } else {
-                slice1 =
-                    monitor_single_address_core((uintptr_t)mem + offset1, 0);
-                slice2 =
-                    monitor_single_address_core((uintptr_t)mem + offset2, 0);
-            }
-            // for each address bit i of function bit k
-            for (k = 0; k < nbits; k++) {
-                oj_a1 =
-                    (slice1 >> k) & 1; // bit k of output of slice for address 1
-                oj_a2 = (slice2 >> k) & 1;
-                if (oj_a1 != oj_a2) {
-                    w[k][i]++;
-                }
-            }
+    return mem;
+}
+
+/*
+ * Slices of a few lines (at most MAX_BATCH). Lines measured before, for
+ * another bit, are taken from the cache and only the others are probed. The
+ * first nb_fresh lines are always probed again (and their entries refreshed).
+ */
+static void probe_lines(const uintptr_t *addrs, int n, int nb_fresh,
+                        int *slices) {
+    uintptr_t missing[MAX_BATCH];
+    int missing_index[MAX_BATCH];
+    const line_entry_t *e;
+    probe_result_t res[MAX_BATCH];
+    int i, nb_missing = 0;
+
+    for (i = 0; i < n; i++) {
+        e = i < nb_fresh ? NULL
+                         : line_cache_lookup(&measured, translate(addrs[i]));
+        if (e != NULL) {
+            slices[i] = e->slice;
+        } else {
+            missing_index[nb_missing] = i;
+            missing[nb_missing++] = addrs[i];
         }
-#if DEBUG
-        fprintf(stderr,".");
-#endif // DEBUG
+    }
+    if (nb_missing == 0) {
+        return;
     }
 
-    munmap(mem, HUGE_PAGE_SIZE_2M);
+    if (monitor_probe_batch(missing, nb_missing, res) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nb_missing; i++) {
+        slices[missing_index[i]] = res[i].slice;
+        line_cache_insert(&measured, res[i].paddr, res[i].slice,
+                          res[i].margin);
+    }
+}
 
-    /*
-     * Find the other bits, until bit 33
-     */
+/*
+ * Pages whose physical addresses XOR to a single bit. A pair differs only in
+ * that bit; with a linear hash, three or four pages whose frames XOR to the bit
+ * isolate it as well, which reaches bits that no pair of pages does.
+ */
+typedef struct {
+    int n; // 0 while the bit has no pages
+    uintptr_t page[4];
+} bit_pages_t;
 
-    // Finding the number of free huge pages
-    char *cmd = "grep 'HugePages_Free' /proc/meminfo | awk '{print $2}'";
-    int hugepages_free = 0;
+/*
+ * Samples of an address bit: one line in each of its pages, whose slices XOR
+ * to the slice of the bit alone when the hash is linear.
+ *
+ * With an even number of pages, sample j is line j of every page: the
+ * offsets cancel out. The offset of line j skips the bit itself, so that
+ * both addresses of a pair inside one page stay in their page. With three
+ * pages, the third line is at the XOR of the offsets of the other two, the
+ * second one being line j scrambled over the first 2M, so that no line is
+ * measured for every sample.
+ *
+ * This also plans the pairs for reuse inside a page: for a bit below 16 both
+ * sides of the first 512 pairs are among the first 1024 lines of the page,
+ * so a line measured for one bit is often a side of a pair of another one.
+ * The base of sample j, its line in the first page, is only shared by the
+ * bits above 6 + log2(j) of a page (the offset skips the bit), and pages
+ * differ from one bit to the next: it is probed again each time, so that
+ * the reuse only comes from the other sides, and a bad measurement of a
+ * shared base does not bias all the bits that use it.
+ */
+static void sample_bit(bit_evidence_t *ev, const bit_pages_t *pages, int bit,
+                       int nb_samples, int nbits) {
+    unsigned long long line, offset, scrambled;
+    uintptr_t addrs[4];
+    int i, j, k, flips, slices[4];
+
+    for (j = 0; j < nb_samples; j++) {
+        line = (unsigned long long)(ev->samples + j) << 6;
+        offset = (line & ((1ULL << bit) - 1)) | (line >> bit << (bit + 1));
+        for (i = 0; i < pages->n; i++) {
+            addrs[i] = pages->page[i] + offset;
+        }
+        if (pages->n == 3) {
+            // 40503 is odd: a permutation of the 32768 lines of 2M
+            scrambled = ((ev->samples + j) * 40503ULL & 0x7fff) << 6;
+            addrs[1] = pages->page[1] + scrambled;
+            addrs[2] = pages->page[2] + (offset ^ scrambled);
+        }
+        nb_pairs++;
+        probe_lines(addrs, pages->n, 1, slices);
+
+        flips = 0;
+        for (i = 0; i < pages->n; i++) {
+            flips ^= slices[i];
+        }
+        // for each output bit k of the slice
+        for (k = 0; k < nbits; k++) {
+            if ((flips >> k) & 1) {
+                ev->flips[k]++;
+            }
+        }
+    }
+    ev->samples += nb_samples;
+}
 
-    char buf[10];
-    FILE *fp;
+/*
+ * Save the progress of the run, at most every CHECKPOINT_PERIOD seconds
+ * unless forced. A failed save is reported but does not stop the run.
+ */
+static void save_progress(int force) {
+    struct timespec now;
+    char path[4096];
+    int ret;
 
-    if ((fp = popen(cmd, "r")) == NULL) {
-        fprintf(stderr,"Error opening pipe!\n");
-        exit(EXIT_FAILURE);
+    if (checkpoint_file == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!force && now.tv_sec - last_checkpoint.tv_sec < CHECKPOINT_PERIOD) {
+        return;
+    }
+    last_checkpoint = now;
+
+    progress.nb_pairs = nb_pairs;
+    ret = checkpoint_save(socket_file(path, sizeof(path), checkpoint_file),
+                          &progress);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot save the checkpoint %s: %s\n", path,
+                strerror(-ret));
     }
+}
 
-    while (fgets(buf, 10, fp) != NULL) {
-        hugepages_free = (int)strtol(buf, NULL, 10);
-        // printf("%d\n", hugepages_free);
+/*
+ * Evidence of a run of a reverse function, continued from the checkpoint
+ * when resuming. A checkpoint of another CPU, slice count or reverse function
+ * is refused.
+ */
+static bit_evidence_t *start_run(int method) {
+    char path[4096];
+    int ret;
+
+    memset(&progress, 0, sizeof(progress));
+    progress.magic = CHECKPOINT_MAGIC;
+    progress.version = CHECKPOINT_VERSION;
+    progress.signature = get_cpu_signature();
+    progress.nb_slices = socket_ctx->nb_cores;
+    progress.method = method;
+    clock_gettime(CLOCK_MONOTONIC, &last_checkpoint);
+    if (!resume) {
+        return progress.ev;
     }
 
-    if (pclose(fp)) {
-        fprintf(stderr,"Command not found or exited with error status\n");
+    checkpoint_t saved;
+    socket_file(path, sizeof(path), checkpoint_file);
+    ret = checkpoint_load(path, &saved);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot resume from %s: %s\n", path,
+                ret == -EINVAL ? "not a checkpoint" : strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+    if (saved.signature != progress.signature ||
+        saved.nb_slices != progress.nb_slices) {
+        fprintf(stderr,
+                "Cannot resume from %s: saved on CPU 0x%x with %d slices, "
+                "this is CPU 0x%x with %d slices\n",
+                path, saved.signature, saved.nb_slices, progress.signature,
+                progress.nb_slices);
+        exit(EXIT_FAILURE);
+    }
+    if (saved.method != progress.method) {
+        fprintf(stderr,
+                "Cannot resume from %s: saved by the %s method, this run is "
+                "the %s method\n",
+                path,
+                saved.method >= 0 && saved.method <= RUN_GENERIC
+                    ? run_names[saved.method]
+                    : "unknown",
+                run_names[progress.method]);
         exit(EXIT_FAILURE);
     }
+    progress = saved;
+    nb_pairs = saved.nb_pairs;
+    printf("Resuming from %s: %d bits done, %ld pairs probed\n", path,
+           __builtin_popcountll(saved.done), (long)saved.nb_pairs);
 
-// Mapping memory
-#define MMAP_SIZE_CORE (0x200000UL * hugepages_free)
-    unsigned long long paddr1, paddr2, candidate;
-    unsigned long long mask;
-    unsigned long long offset1_i, offset2_i;
-    int is_candidate = 0;
+    return progress.ev;
+}
 
-    mem = (char *)mmap(NULL, MMAP_SIZE_CORE, PROT_READ | PROT_WRITE,
-                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB,
-                       -1, 0);
-    if (mem == MAP_FAILED) {
-        fprintf(stderr,"second mmap huge page has failed \n");
-        exit(EXIT_FAILURE);
-    }
-    for (i = 0; i < MMAP_SIZE_CORE; i++) {
-        mem[i] = 12;
-    }
-
-    // For each bit 21+k -> 33 (bit_max)
-    int bit_max = ceil(log2(MMAP_SIZE_CORE));
-    for (k = 0; k < bit_max - 21 + 1; k++) {
-        is_candidate = 0;
-        // Note: shifting by more than 32 bits produce undefined behavior
-        // (and opens all sorts of hell)
-        // Hence, shifting in two stages
-        mask = (unsigned long long)(1 << 21);
-        mask = (unsigned long long)(mask << k);
-
-        // Calculate offset1 and offset2
-        // such as the addresses differ by one bit only
-        for (i = 0; i < hugepages_free; i++) {
-            offset1 = i * 0x200000UL;
-            paddr1 = (unsigned long long)read_pagemap("/proc/self/pagemap",
-                                                      (uintptr_t)mem + offset1);
-            candidate = paddr1 ^ mask;
-            for (j = i; j < hugepages_free; j++) {
-                offset2 = j * 0x200000UL;
-                paddr2 = (unsigned long long)read_pagemap(
-                    "/proc/self/pagemap", (uintptr_t)mem + offset2);
-                if (candidate == paddr2) {
-                    is_candidate = 1;
-                    break;
-                }
-            }
-            if (is_candidate) {
-                break;
-            }
-            if (is_candidate == 0 && i == hugepages_free - 1) {
-                printf("Not able to test bit %d\n", k + 21);
-            }
+/*
+ * Sample the address bits [first, last) that have pages: every bit
+ * first gets FIRST_SAMPLES pairs, to estimate the noise, then each bit is
+ * sampled one pair at a time until its decision is confident enough or it
+ * reaches max_samples pairs.
+ */
+static void recover_bits(bit_evidence_t *ev, const bit_pages_t *pages,
+                         int first, int last, int max_samples, int nbits) {
+    int bit, nb_ambiguous = 0;
+    double noise;
+
+    for (bit = first; bit < last; bit++) {
+        if (pages[bit].n > 0 && !((progress.done >> bit) & 1) &&
+            ev[bit].samples < FIRST_SAMPLES) {
+            sample_bit(&ev[bit], &pages[bit], bit,
+                       MIN(FIRST_SAMPLES, max_samples) - ev[bit].samples,
+                       nbits);
         }
+    }
 
-        // Now, test on 100 different addresses
-        for (i = 0; i < 500; i++) {
-            offset1_i = offset1 + (i << 6);
-            offset2_i = offset2 + (i << 6);
-            if (clflush) {
-                slice1 = monitor_single_address_clflush(
-                    (uintptr_t)mem + offset1_i, 0);
-                slice2 = monitor_single_address_clflush(
-                    (uintptr_t)mem + offset2_i, 0);
-            } else {
-                slice1 =
-                    monitor_single_address_core((uintptr_t)mem + offset1_i, 0);
-                slice2 =
-                    monitor_single_address_core((uintptr_t)mem + offset2_i, 0);
-            }
-            // for each bit of slice
-            for (j = 0; j < nbits; j++) {
-                oj_a1 =
-                    (slice1 >> j) & 1; // bit j of output of slice for address 1
-                oj_a2 = (slice2 >> j) & 1;
-                if (oj_a1 != oj_a2) {
-                    w[j][k + 15] += 1;
-                }
-            }
+    save_progress(1);
+
+    for (bit = first; bit < last; bit++) {
+        noise = decode_noise(ev, 64, nbits);
+        if ((progress.done >> bit) & 1) {
+            nb_ambiguous += decode_ambiguous(&ev[bit], nbits, noise);
+            continue;
+        }
+        if (pages[bit].n == 0) {
+            continue;
+        }
+        while (ev[bit].samples < max_samples &&
+               decode_ambiguous(&ev[bit], nbits, noise)) {
+            sample_bit(&ev[bit], &pages[bit], bit, 1, nbits);
+            noise = decode_noise(ev, 64, nbits);
+            save_progress(0);
+        }
+        nb_ambiguous += decode_ambiguous(&ev[bit], nbits, noise);
+        progress.done |= 1ULL << bit;
+        progress.next_bit = bit + 1;
+        save_progress(1);
+        if (verbose) {
+            printf("Bit %d: %d pairs\n", bit, ev[bit].samples);
         }
 #if DEBUG
-            fprintf(stderr,".");
+        fprintf(stderr, ".");
 #endif // DEBUG
     }
+    if (verbose) {
+        printf("Bits %d-%d: %d ambiguous\n", first, last - 1, nb_ambiguous);
+    }
+}
 
-    munmap(mem, MMAP_SIZE_CORE);
+/*
+ * Print the bits of each output bit of the function, and on stderr how sure
+ * we are: bits that are still ambiguous are flagged instead of being guessed
+ */
+static int print_function(const bit_evidence_t *ev, int nbits) {
+    double noise = decode_noise(ev, 64, nbits);
+    double confidence, lowest = 1;
+    int i, k, decision, nb_ambiguous = 0;
 
-    /*
-     * Look at the tables to find bits that intervene in the function
-     */
-    for (j = 0; j < nbits; j++) {
-        printf("\no%d =", j);
-        for (i = 0; i < 33; i++) {
-            if (w[j][i] >
-                200) { // change constant to avoid noise on the results
-                printf(" b%llu", i + 6);
+    fprintf(stderr, "\n");
+    for (k = 0; k < nbits; k++) {
+        fprintf(stderr, "\no%d =", k);
+        printf("\no%d =", k);
+        for (i = 0; i < 64; i++) {
+            decision = decode_bit(ev[i].flips[k], ev[i].samples, noise,
+                                  &confidence);
+            if (decision == DECODE_IN) {
+                fprintf(stderr, " b%d", i);
+                printf(" b%d", i);
+            }
+            if (ev[i].samples > 0 && decision != DECODE_AMBIGUOUS &&
+                confidence < lowest) {
+                lowest = confidence;
             }
         }
+        fprintf(stderr, "\n");
         printf("\n");
     }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "\n%ld pairs probed in %.2f s\n", nb_pairs,
+            (now.tv_sec - reverse_start.tv_sec) +
+                (now.tv_nsec - reverse_start.tv_nsec) / 1e9);
+    fprintf(stderr, "Huge pages populated in %.2f s\n", populate_time);
+    fprintf(stderr, "%lu lines measured, %lu taken from the cache\n",
+            measured.misses, measured.hits);
+    fprintf(stderr, "Noise rate %.2f%%, lowest confidence %.6f\n",
+            100 * noise, lowest);
+    for (i = 0; i < 64; i++) {
+        for (k = 0; k < nbits && ev[i].samples > 0; k++) {
+            decision = decode_bit(ev[i].flips[k], ev[i].samples, noise,
+                                  &confidence);
+            if (decision == DECODE_AMBIGUOUS) {
+                fprintf(stderr,
+                        "Ambiguous: o%d b%d flipped %d times in %d pairs "
+                        "(confidence %.3f)\n",
+                        k, i, ev[i].flips[k], ev[i].samples, confidence);
+                nb_ambiguous++;
+            }
+        }
+    }
+    if (nb_ambiguous > 0) {
+        fprintf(stderr, "%d ambiguous bits: run again or on a quieter host\n",
+                nb_ambiguous);
+    }
+    return nb_ambiguous;
 }
 
-void reverse_xeon() {
-    register unsigned long long i;
-    int j, k;
-    unsigned long long offset1, offset2;
-    int slice1, slice2;
-    int nbits = ceil(log2(nb_cores));
-    int oj_a1, oj_a2;
-    int w[4][29] = {{0}};
+/*
+ * Index the huge pages of a mapping by physical frame
+ */
+static void index_pages(hugepool_t *pool, char *mem, int nb_pages,
+                        int page_shift) {
+    int ret = hugepool_init(pool, mem, nb_pages, page_shift);
 
-    /*
-     * Find the first 30 bits
-     */
-    // Allocate and initialize 1GB
-    char *mem = (char *)mmap(
-        NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
-    if (mem == MAP_FAILED) {
-        fprintf(stderr,"Malloc huge page has failed \n");
+    if (ret < 0) {
+        fprintf(stderr, "Cannot index the huge pages: %s\n", strerror(-ret));
         exit(EXIT_FAILURE);
     }
-    for (i = 0; i < HUGE_PAGE_SIZE; i++) {
-        mem[i] = 12;
-    }
+}
 
-    // Find the first 30th bits
-    for (i = 0; i < 24; i++) {
-        for (j = 0; j < 100; j++) {
-            offset1 = j << 6;
-            offset2 = offset1 ^ (1 << (i + 6));
-            if (clflush) {
-                slice1 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset1, 0);
-                slice2 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset2, 0);
+/*
+ * Find pages of the pool that isolate each bit in [first, last) that has no
+ * pages yet: a pair differing only in that bit, or, when the hash is linear,
+ * three or four pages whose frames XOR to it. The pairs of pages are only
+ * indexed for these, the first time a bit needs them, and a pool too large
+ * to index leaves such bits untested.
+ */
+static void pair_pages(hugepool_t *pool, int first, int last,
+                       bit_pages_t *pages) {
+    int is_linear = is_powerof_two(socket_ctx->nb_cores);
+    int bit, i, ret, found[4];
+
+    for (bit = first; bit < last; bit++) {
+        if (pages[bit].n > 0) {
+            continue;
+        }
+        if (hugepool_pairs(pool, bit, found, 1) == 1) {
+            pages[bit].n = 2;
+        } else if (!is_linear) {
+            printf("Not able to test bit %d\n", bit);
+            continue;
+        } else if ((ret = hugepool_index_pairs(pool)) < 0) {
+            if (ret == -E2BIG) {
+                printf("Not able to test bit %d: no pair, and %d pages are "
+                       "too many to search for more (at most %d)\n",
+                       bit, pool->nb_pages, HUGEPOOL_MAX_PAIRED);
             } else {
-                slice1 = monitor_single_address((uintptr_t)mem + offset1);
-                slice2 = monitor_single_address((uintptr_t)mem + offset2);
-            }
-            // for each bit of slice
-            for (k = 0; k < nbits; k++) {
-                oj_a1 =
-                    (slice1 >> k) & 1; // bit k of output of slice for address 1
-                oj_a2 = (slice2 >> k) & 1;
-                if (oj_a1 != oj_a2) {
-                    w[k][i]++;
-                }
+                printf("Not able to test bit %d: %s\n", bit, strerror(-ret));
             }
+            continue;
+        } else if (hugepool_triples(pool, bit, found, 1) == 1) {
+            pages[bit].n = 3;
+        } else if (hugepool_quads(pool, bit, found, 1) == 1) {
+            pages[bit].n = 4;
+        } else {
+            printf("Not able to test bit %d\n", bit);
+            continue;
+        }
+        for (i = 0; i < pages[bit].n; i++) {
+            pages[bit].page[i] = hugepool_page(pool, found[i]);
+        }
+        if (verbose && pages[bit].n > 2) {
+            printf("Bit %d tested on %d pages\n", bit, pages[bit].n);
         }
     }
+}
 
-    munmap(mem, HUGE_PAGE_SIZE);
+static int compare_paddr(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
 
 /*
- * Find the other bits, until bit 34
+ * Check a function against the measured slices of nb_lines random lines of
+ * huge pages, one page mapped per VALIDATE_PAGE lines (as many as are free at
+ * most). The predictions are computed in one batch, and the accuracy of each
+ * output bit is reported. With regions, the pages are of the size with the
+ * most free memory, to spread the lines over the physical memory, and the 1G
+ * regions where more than VALIDATE_FLAG of the predictions fail are flagged;
+ * otherwise they are of the smallest size with a free page. Returns the
+ * number of mispredicted lines.
  */
-//#define MMAP_SIZE 0x300000000UL
-#define NB_PAGES 11
-#define MMAP_SIZE (0x40000000UL * NB_PAGES)
-    unsigned long long paddr1, paddr2, candidate;
-    unsigned long long mask;
-    unsigned long long offset1_i, offset2_i;
-    int is_candidate = 0;
-
-    mem = (char *)mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE,
-                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB,
-                       -1, 0);
+static long validate_model(const model_t *model, long nb_lines, int regions) {
+    hugetlb_size_t sizes[HUGETLB_MAX_SIZES];
+    int nb_sizes = hugetlb_sizes(sizes, HUGETLB_MAX_SIZES, hugepages_node());
+    int i, k, best = -1, nbits = ceil(log2(model->nb_slices));
+    long j, n, start, nb_errors = 0, bit_errors[DECODE_MAX_OUTPUTS] = {0};
+    int batch = monitor_batch_size();
+    uintptr_t addrs[MAX_BATCH];
+    hugepool_t pool;
+    size_t len;
+    long nb_pages;
+
+    // Sizes come largest first
+    for (i = 0; i < nb_sizes; i++) {
+        if (sizes[i].free < 1 || 1L << (sizes[i].shift - 6) < VALIDATE_PAGE) {
+            continue;
+        }
+        if (best < 0 || !regions ||
+            sizes[i].free << sizes[i].shift >
+                sizes[best].free << sizes[best].shift) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        fprintf(stderr, "No free huge page to validate the function\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t *paddrs = (uint64_t *)malloc(nb_lines * sizeof(uint64_t));
+    uint32_t *index = (uint32_t *)malloc(nb_lines * sizeof(uint32_t));
+    int *predicted = (int *)malloc(nb_lines * sizeof(int));
+    int *slices = (int *)malloc(nb_lines * sizeof(int));
+    uint64_t *failures = (uint64_t *)malloc(nb_lines * sizeof(uint64_t));
+    if (paddrs == NULL || index == NULL || predicted == NULL ||
+        slices == NULL || failures == NULL) {
+        fprintf(stderr, "Cannot allocate %ld lines to validate\n", nb_lines);
+        exit(EXIT_FAILURE);
+    }
+
+    nb_pages = MIN(sizes[best].free,
+                   (nb_lines + VALIDATE_PAGE - 1) / VALIDATE_PAGE);
+    len = (size_t)nb_pages << sizes[best].shift;
+    char *mem = hugetlb_map(nb_pages, sizes[best].shift);
     if (mem == MAP_FAILED) {
-        fprintf(stderr, "Malloc huge page has failed \n");
-        exit(EXIT_FAILURE);
-    }
-    for (i = 0; i < MMAP_SIZE; i++) {
-        mem[i] = 12;
-    }
-
-    // For each bit 30+k
-    for (k = 0; k < 5; k++) {
-        is_candidate = 0;
-        // Note: shifting by more than 32 bits produce undefined behavior
-        // (and opens all sorts of hell)
-        // Hence, shifting in two stages
-        mask = (unsigned long long)(1 << 30);
-        mask = (unsigned long long)(mask << k);
-
-        // Calculate offset1 and offset2
-        // such as the addresses differ by one bit only
-        for (i = 0; i < NB_PAGES; i++) {
-            offset1 = i * 0x40000000UL;
-            paddr1 = (unsigned long long)read_pagemap("/proc/self/pagemap",
-                                                      (uintptr_t)mem + offset1);
-            candidate = paddr1 ^ mask;
-            for (j = i; j < NB_PAGES; j++) {
-                offset2 = j * 0x40000000UL;
-                paddr2 = (unsigned long long)read_pagemap(
-                    "/proc/self/pagemap", (uintptr_t)mem + offset2);
-                if (candidate == paddr2) {
-                    is_candidate = 1;
-                    break;
-                }
-            }
-            if (is_candidate) {
-                break;
-            }
-            if (is_candidate == 0 && i == NB_PAGES - 1) {
-                printf("Not able to test bit %d\n", k + 30);
-            }
+        fprintf(stderr, "mmap huge pages has failed \n");
+        exit(EXIT_FAILURE);
+    }
+    map_pages(mem, len, sizes[best].shift);
+    index_pages(&pool, mem, nb_pages, sizes[best].shift);
+    if (monitor_arm() < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Measure random lines, a batch at a time
+    for (j = 0; j < nb_lines; j += n) {
+        n = MIN(batch, nb_lines - j);
+        for (i = 0; i < n; i++) {
+            addrs[i] = hugepool_page(&pool, random() % pool.nb_pages) +
+                       (random() % (1L << (pool.page_shift - 6)) << 6);
+            paddrs[j + i] = translate(addrs[i]);
         }
+        probe_lines(addrs, n, 0, &slices[j]);
+    }
+    monitor_disarm();
+    hugepool_free(&pool);
+    unmap_pages(mem, len);
 
-        // Now, test on 100 different addresses
-        for (i = 0; i < 100; i++) {
-            offset1_i = offset1 + (i << 6);
-            offset2_i = offset2 + (i << 6);
-            if (clflush) {
-                slice1 = monitor_single_address_clflush(
-                    (uintptr_t)mem + offset1_i, 0);
-                slice2 = monitor_single_address_clflush(
-                    (uintptr_t)mem + offset2_i, 0);
-            } else {
-                slice1 = monitor_single_address((uintptr_t)mem + offset1_i);
-                slice2 = monitor_single_address((uintptr_t)mem + offset2_i);
-            }
+    model_eval_batch(model, paddrs, nb_lines, index, predicted);
 
-            // for each bit of slice
-            for (j = 0; j < nbits; j++) {
-                oj_a1 =
-                    (slice1 >> j) & 1; // bit j of output of slice for address 1
-                oj_a2 = (slice2 >> j) & 1;
-                if (oj_a1 != oj_a2) {
-                    w[j][k + 24] += 1;
-                }
-            }
+    n = 0;
+    for (j = 0; j < nb_lines; j++) {
+        if (paddrs[j] == 0) {
+            fprintf(stderr, "Cannot translate addresses (not root?)\n");
+            exit(EXIT_FAILURE);
+        }
+        for (k = 0; k < nbits && k < DECODE_MAX_OUTPUTS; k++) {
+            bit_errors[k] += ((predicted[j] ^ slices[j]) >> k) & 1;
+        }
+        if (predicted[j] != slices[j]) {
+            failures[nb_errors++] = paddrs[j];
         }
     }
 
-    munmap(mem, MMAP_SIZE);
+    fprintf(stderr, "\nValidation: %ld of %ld lines predicted (%.3f%%)\n",
+            nb_lines - nb_errors, nb_lines,
+            100.0 * (nb_lines - nb_errors) / nb_lines);
+    for (k = 0; k < nbits && k < DECODE_MAX_OUTPUTS; k++) {
+        fprintf(stderr, "o%d: %.3f%% correct\n", k,
+                100.0 * (nb_lines - bit_errors[k]) / nb_lines);
+    }
 
-    /*
-     * Look at the tables to find bits that intervene in the function
-     */
-    for (j = 0; j < nbits; j++) {
-        printf("\no%d =", j);
-        for (i = 0; i < 29; i++) {
-            if (w[j][i] > 10) {
-                printf(" b%llu", i + 6);
+    // Lines and failures of each region, both sorted by physical address
+    qsort(paddrs, nb_lines, sizeof(uint64_t), compare_paddr);
+    qsort(failures, nb_errors, sizeof(uint64_t), compare_paddr);
+    for (start = 0, n = 0; regions && start < nb_lines; start = j) {
+        uint64_t region = paddrs[start] >> VALIDATE_REGION;
+        long wrong = 0;
+
+        for (j = start; j < nb_lines && paddrs[j] >> VALIDATE_REGION == region;
+             j++) {
+        }
+        for (; n < nb_errors && failures[n] >> VALIDATE_REGION == region; n++) {
+            wrong++;
+        }
+        if (wrong > VALIDATE_FLAG * (j - start)) {
+            fprintf(stderr,
+                    "Mispredicted: 0x%llx-0x%llx, %ld of %ld lines wrong\n",
+                    (unsigned long long)region << VALIDATE_REGION,
+                    ((unsigned long long)(region + 1) << VALIDATE_REGION) - 1,
+                    wrong, j - start);
+        }
+    }
+
+    free(paddrs);
+    free(index);
+    free(predicted);
+    free(slices);
+    free(failures);
+
+    return nb_errors;
+}
+
+/*
+ * A linear function as a model whose table is the identity, for the slices
+ * measured (only a power of two of them is a linear function of the bits)
+ */
+static void masks_model(model_t *model, const uint64_t *masks, int nbits) {
+    int i;
+
+    if (model_init(model, socket_ctx->nb_cores, nbits) < 0) {
+        fprintf(stderr, "Cannot allocate the function\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nbits; i++) {
+        model->masks[i] = masks[i];
+    }
+    for (i = 0; i < 1 << nbits; i++) {
+        model->table[i] = i;
+    }
+}
+
+/*
+ * Validate the function found by a reverse if asked to, and add it to the
+ * registry unless some bits are ambiguous or the validation failed
+ */
+static void found_function(const model_t *model, int nb_ambiguous) {
+    long nb_errors = 0;
+    int i, ret;
+
+    if (validate > 0) {
+        nb_errors = validate_model(model, validate, 1);
+    }
+    if (registry_file == NULL) {
+        return;
+    }
+    if (nb_ambiguous > 0 || nb_errors > VALIDATE_FLAG * validate) {
+        fprintf(stderr, "Function not added to %s: it is not certain\n",
+                registry_file);
+        return;
+    }
+    for (i = 0; i < 1 << model->nb_bits; i++) {
+        if (model->table[i] >= model->nb_slices) {
+            fprintf(stderr, "Function not added to %s: its output bits do not "
+                            "number %d slices\n",
+                    registry_file, model->nb_slices);
+            return;
+        }
+    }
+    ret = registry_add(registry_file, get_cpu_signature(), model);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot add the function to %s: %s\n", registry_file,
+                strerror(-ret));
+        return;
+    }
+    if (ret == 1) {
+        fprintf(stderr, "Function already in %s for CPU 0x%x\n",
+                registry_file, get_cpu_signature());
+        return;
+    }
+    fprintf(stderr, "Function added to %s for CPU 0x%x\n", registry_file,
+            get_cpu_signature());
+}
+
+static void found_masks(const uint64_t *masks, int nbits, int nb_ambiguous) {
+    model_t model;
+
+    masks_model(&model, masks, nbits);
+    found_function(&model, nb_ambiguous);
+    model_free(&model);
+}
+
+/*
+ * Print a function of the registry: linear ones like the reverse prints
+ * them, the others in the model format
+ */
+static void print_model(const model_t *model) {
+    int i, k;
+
+    for (i = 0; i < 1 << model->nb_bits && model->table[i] == i; i++)
+        ;
+    if (i < 1 << model->nb_bits) {
+        model_write(model, stdout);
+        return;
+    }
+    for (k = 0; k < model->nb_bits; k++) {
+        printf("\no%d =", k);
+        for (i = 6; i < 64; i++) {
+            if (model->masks[k] >> i & 1) {
+                printf(" b%d", i);
             }
         }
         printf("\n");
     }
 }
 
-//////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////
+/*
+ * Look up the function of this CPU and slice count in the registry, and
+ * check it on a few random lines. Returns 1 if it holds, in which case there
+ * is nothing to reverse.
+ */
+int known_function() {
+    unsigned int signature = get_cpu_signature();
+    registry_t registry;
+    const model_t *known;
+    long nb_errors;
+    int ret;
+
+    ret = registry_load(&registry, registry_file);
+    if (ret == -ENOENT) {
+        return 0; // created once a function is found
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Cannot read %s: %s\n", registry_file, strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+    known = registry_find(&registry, signature, socket_ctx->nb_cores);
+    if (known == NULL) {
+        fprintf(stderr, "No function known for CPU 0x%x with %d slices\n",
+                signature, socket_ctx->nb_cores);
+        registry_free(&registry);
+        return 0;
+    }
 
-void reverse_generic() {
-    register unsigned long long i;
-    int j, k;
-    unsigned long long offset1, offset2;
-    int slice1, slice2;
-    int nbits = ceil(log2(nb_cores));
-    int oj_a1, oj_a2;
-    int w[4][40] = {{0}};
+    fprintf(stderr, "Spot-checking the function known for CPU 0x%x\n",
+            signature);
+    nb_errors = validate_model(known, SPOT_CHECK_LINES, 0);
+    if (nb_errors > SPOT_CHECK_ERRORS) {
+        fprintf(stderr, "The known function mispredicts %ld of %d lines, "
+                        "reversing it again\n",
+                nb_errors, SPOT_CHECK_LINES);
+        registry_free(&registry);
+        return 0;
+    }
+    print_model(known);
+    registry_free(&registry);
+
+    return 1;
+}
+
+/*
+ * Reverse the function bit by bit with the huge pages the kernel offers.
+ *
+ * The bits inside a page come from a single page of the largest size with a
+ * free page: its lines are physically contiguous, so the pairs need no
+ * translation (6-29 with a 1G page). The other bits come from page pairs of
+ * the size whose free pages span the most address bits, the larger size on a
+ * tie, with just enough pages to span the highest bit still to resolve.
+ */
+static void reverse_bits(int method, int max_samples) {
+    int nbits = ceil(log2(socket_ctx->nb_cores));
+    bit_evidence_t *ev = start_run(method);
+    bit_pages_t pages[64] = {{0}};
+    hugetlb_size_t sizes[HUGETLB_MAX_SIZES];
+    int bit, bit_end, last, low, high;
+    long nb_pages;
+    hugepool_t pool;
+    size_t len;
+    char *mem;
+
+    int nb_sizes = hugetlb_sizes(sizes, HUGETLB_MAX_SIZES, hugepages_node());
+    for (low = 0; low < nb_sizes && sizes[low].free < 1; low++)
+        ;
+    high = widest_size(sizes, nb_sizes, &bit_end);
+    if (high < 0) {
+        fprintf(stderr, "No free huge page\n");
+        exit(EXIT_FAILURE);
+    }
+    if (verbose) {
+        printf("Bits 6-%d from a %luM page, bits %d-%d from %luM pages\n",
+               sizes[low].shift - 1, 1UL << (sizes[low].shift - 20),
+               sizes[low].shift, bit_end - 1, 1UL << (sizes[high].shift - 20));
+    }
+
+    if (monitor_arm() < 0) {
+        exit(EXIT_FAILURE);
+    }
 
     /*
-     * Find the first 21 bits
+     * Find the bits inside a page
      */
-    // Allocate and initialize a huge page of 2MB
-    char *mem = (char *)mmap(
-        NULL, HUGE_PAGE_SIZE_2M, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+    len = 1UL << sizes[low].shift;
+    mem = hugetlb_map(1, sizes[low].shift);
     if (mem == MAP_FAILED) {
-        fprintf(stderr,"first mmap huge page has failed \n");
+        fprintf(stderr, "first mmap huge page has failed \n");
         exit(EXIT_FAILURE);
     }
-    for (i = 0; i < HUGE_PAGE_SIZE_2M; i++) {
-        mem[i] = 12;
-    }
+    map_pages(mem, len, sizes[low].shift);
 
 #if DEBUG
     fprintf(stderr, "Progress: ");
 #endif // DEBUG
-    // Find the first 21 bits
-    for (i = 0; i < 15; i++) {
-        if(verbose) {
-            printf("Bit %lld\n", i + 6);
-        }
-        for (j = 0; j < ADDR_PER_BIT; j++) {
-            offset1 = j << 6;
-            offset2 = offset1 ^ (1 << (i + 6));
-            if(verbose) {
-                printf("Comparing %p and %p:", mem + offset1, mem + offset2);
-            }
-            if (clflush) {
-                slice1 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset1, 0);
-                slice2 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset2, 0);
-            } else if (class == INTEL_CORE) {
-                slice1 =
-                    monitor_single_address_core((uintptr_t)mem + offset1, 0);
-                slice2 =
-                    monitor_single_address_core((uintptr_t)mem + offset2, 0);
-            } else {
-                slice1 = monitor_single_address((uintptr_t)mem + offset1);
-                slice2 = monitor_single_address((uintptr_t)mem + offset2);
-            }
-            if(verbose) {
-                printf("Slice1 %d, Slice2 %d\n", slice1, slice2);
-            }
-            // for each address bit i of function bit k
-            for (k = 0; k < nbits; k++) {
-                oj_a1 =
-                    (slice1 >> k) & 1; // bit k of output of slice for address 1
-                oj_a2 = (slice2 >> k) & 1;
-                if (oj_a1 != oj_a2) {
-                    if(verbose) {
-                        printf("Found address bit %lld used for hash bit %d\n", i,
-                               k);
-                    }
-                    w[k][i]++;
-                }
-            }
-        }
-        if(verbose) {
-            printf("For addr bit %lld: ", i + 6);
+    for (bit = 6; bit < sizes[low].shift; bit++) {
+        pages[bit].n = 2;
+        pages[bit].page[0] = (uintptr_t)mem;
+        pages[bit].page[1] = (uintptr_t)mem + (1UL << bit);
+    }
+    recover_bits(ev, pages, 6, sizes[low].shift, max_samples, nbits);
 
-            for (k = 0; k < nbits; k++) {
-                printf("hash bit %d: %d samples, ", k, w[k][i]);
-            }
-            printf("\n");
+    unmap_pages(mem, len);
+
+    /*
+     * Find the other bits, until bit_end. A resumed run may have done the
+     * top ones already: the pages only have to span the last bit left.
+     */
+    for (last = bit_end;
+         last > sizes[low].shift && (progress.done >> (last - 1) & 1); last--)
+        ;
+    if (last > sizes[low].shift) {
+        nb_pages = MIN(sizes[high].free, 1L << (last - sizes[high].shift));
+        len = (size_t)nb_pages << sizes[high].shift;
+        mem = hugetlb_map(nb_pages, sizes[high].shift);
+        if (mem == MAP_FAILED) {
+            fprintf(stderr, "second mmap huge page has failed \n");
+            exit(EXIT_FAILURE);
         }
-#if DEBUG
-        fprintf(stderr, ".");
-#endif // DEBUG
-    }
-    if(verbose) {
-        printf("Done bit up to %lld\n", i + 6);
+        map_pages(mem, len, sizes[high].shift);
+
+        index_pages(&pool, mem, nb_pages, sizes[high].shift);
+        pair_pages(&pool, sizes[low].shift, last, pages);
+        hugepool_free(&pool);
+        recover_bits(ev, pages, sizes[low].shift, last, max_samples, nbits);
+
+        unmap_pages(mem, len);
     }
 
-    munmap(mem, HUGE_PAGE_SIZE_2M);
+    monitor_disarm();
 
     /*
-     * Find the other bits, until bit 33
+     * Look at the evidence to find bits that intervene in the function
      */
+    int nb_ambiguous = print_function(ev, nbits);
+
+    if (validate > 0 || registry_file != NULL) {
+        uint64_t masks[DECODE_MAX_OUTPUTS] = {0};
+        double noise = decode_noise(ev, 64, nbits), confidence;
+        int k;
+
+        for (k = 0; k < nbits; k++) {
+            for (bit = 0; bit < 64; bit++) {
+                if (decode_bit(ev[bit].flips[k], ev[bit].samples, noise,
+                               &confidence) == DECODE_IN) {
+                    masks[k] |= 1ULL << bit;
+                }
+            }
+        }
+        found_masks(masks, nbits, nb_ambiguous);
+    }
+}
 
-    // Finding the number of free huge pages
-    char *cmd = "grep 'HugePages_Free' /proc/meminfo | awk '{print $2}'";
-    int hugepages_free = 0;
+void reverse_core() {
+    reverse_bits(RUN_CORE, ADDR_PER_BIT);
+}
 
-    char buf[10];
-    FILE *fp;
+void reverse_xeon() {
+    reverse_bits(RUN_XEON, ADDR_PER_BIT_XEON);
+}
 
-    if ((fp = popen(cmd, "r")) == NULL) {
-        fprintf(stderr, "Error opening pipe!\n");
-        exit(EXIT_FAILURE);
-    }
+void reverse_generic() {
+    reverse_bits(RUN_GENERIC, ADDR_PER_BIT);
+}
 
-    while (fgets(buf, 10, fp) != NULL) {
-        hugepages_free = (int)strtol(buf, NULL, 10);
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#define LINEAR_ATTEMPTS 10 // restarts after an inconsistent sample
+#define LINEAR_CHECKS 32   // redundant samples that must agree at the end
+#define LINEAR_MAX_SAMPLES 8192 // samples per attempt before giving up
+
+/*
+ * Probe the slices of a few random lines of the pool
+ */
+static void probe_random(char *mem, long nb_pages, int page_shift,
+                         uintptr_t *addrs, probe_result_t *res, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        addrs[i] = (uintptr_t)mem +
+                   ((uintptr_t)(random() % nb_pages) << page_shift) +
+                   (random() % (1L << (page_shift - 6)) << 6);
+    }
+    if (monitor_probe_batch(addrs, n, res) < 0) {
+        exit(EXIT_FAILURE);
     }
+}
 
-    if (pclose(fp)) {
-        fprintf(stderr, "Command not found or exited with error status\n");
+/*
+ * Each output bit o_k is a XOR of address bits: it is the solution of the
+ * linear system parity(paddr & mask_k) = bit k of the slice, built from
+ * random addresses. Bit 0 of the rows, always 0 in a line address, stands
+ * for a constant term in case slices are not numbered like the hash.
+ */
+void reverse_linear() {
+    int i, k, attempt, ret = GF2_NEW;
+    int nbits = ceil(log2(socket_ctx->nb_cores));
+    int batch, nb_samples;
+    uint64_t reachable, paddr, row;
+    uint64_t masks[8];
+    uintptr_t addrs[MAX_BATCH];
+    probe_result_t res[MAX_BATCH];
+    gf2_t sys, span;
+
+    if (socket_ctx->nb_cores < 2 || !is_powerof_two(socket_ctx->nb_cores)) {
+        fprintf(stderr, "The hash is only linear for a power of two number "
+                        "of slices (%d)\n",
+                socket_ctx->nb_cores);
         exit(EXIT_FAILURE);
     }
 
-// Mapping memory
-#define MMAP_SIZE_CORE (0x200000UL * hugepages_free)
-    int is_candidate = 0;
+    int page_shift;
+    long nb_pages;
+    char *mem = map_widest(&page_shift, &nb_pages);
+    size_t mmap_size = (size_t)nb_pages << page_shift;
+
+    // Only the address bits that differ somewhere in the pool can be solved,
+    // and the samples can at most reach the rank of these differences (plus
+    // the constant term): page frames need not cover every combination
+    uint64_t first = translate((uintptr_t)mem);
+    gf2_init(&span);
+    reachable = ((1ULL << page_shift) - 1) & ~63ULL;
+    for (i = 6; i < page_shift; i++) {
+        gf2_add(&span, 1ULL << i, 0);
+    }
+    for (i = 1; i < nb_pages; i++) {
+        uint64_t diff =
+            translate((uintptr_t)mem + ((uintptr_t)i << page_shift)) ^ first;
+        reachable |= diff;
+        gf2_add(&span, diff, 0);
+    }
+    int nb_unknowns = gf2_rank(&span) + 1;
+    if (verbose) {
+        printf("Solving for %d address bits (rank %d) from %ld huge pages\n",
+               __builtin_popcountll(reachable), nb_unknowns - 1, nb_pages);
+    }
 
-    mem = (char *)mmap(NULL, MMAP_SIZE_CORE, PROT_READ | PROT_WRITE,
-                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB,
-                       -1, 0);
-    if (mem == MAP_FAILED) {
-        fprintf(stderr, "second mmap huge page has failed \n");
+    if (monitor_arm() < 0) {
         exit(EXIT_FAILURE);
     }
-    for (i = 0; i < MMAP_SIZE_CORE; i++) {
-        mem[i] = 12;
+    srandom(time(NULL));
+    batch = monitor_batch_size();
+
+    for (attempt = 0; attempt < LINEAR_ATTEMPTS; attempt++) {
+        gf2_init(&sys);
+        nb_samples = 0;
+        int nb_checks = 0;
+
+        // Sample until full rank, then until enough samples agree with it.
+        // A rank-deficient system keeps sampling, up to LINEAR_MAX_SAMPLES.
+        while (nb_checks < LINEAR_CHECKS) {
+            if (nb_samples >= LINEAR_MAX_SAMPLES) {
+                fprintf(stderr,
+                        "\nRank %d of %d after %d samples: the random "
+                        "lines do not span the pool\n",
+                        gf2_rank(&sys), nb_unknowns, nb_samples);
+                exit(EXIT_FAILURE);
+            }
+            probe_random(mem, nb_pages, page_shift, addrs, res, batch);
+            for (i = 0; i < batch; i++) {
+                paddr = res[i].paddr;
+                if (paddr == 0) {
+                    fprintf(stderr, "Cannot translate addresses (not root?)\n");
+                    exit(EXIT_FAILURE);
+                }
+                row = (paddr & reachable) | 1;
+                ret = gf2_add(&sys, row, res[i].slice);
+                nb_samples++;
+                if (ret == GF2_INCONSISTENT) {
+                    break;
+                }
+                if (ret == GF2_REDUNDANT && gf2_rank(&sys) == nb_unknowns) {
+                    nb_checks++;
+                }
+            }
+            if (ret == GF2_INCONSISTENT) {
+                break;
+            }
+        }
+        if (verbose) {
+            printf("Attempt %d: rank %d after %d samples%s\n", attempt,
+                   gf2_rank(&sys), nb_samples,
+                   ret == GF2_INCONSISTENT ? ", inconsistent" : "");
+        }
+        if (ret != GF2_INCONSISTENT) {
+            break;
+        }
     }
 
-    // Reverse mapping
-    int bit_max = ceil(log2(MMAP_SIZE_CORE));
-    int mapping_size = pow(2, bit_max - 21 + 2);
-    unsigned long long *rev_map =
-        (unsigned long long *)malloc(mapping_size * sizeof(unsigned long long));
-    for (i = 0; i < mapping_size; i++) {
-        rev_map[i] = -1;
-    }
+    monitor_disarm();
+    unmap_pages(mem, mmap_size);
 
-    for (i = 0; i < hugepages_free; i++) {
-        unsigned long long offset = i * 0x200000UL;
-        unsigned long long paddr = (unsigned long long)read_pagemap(
-            "/proc/self/pagemap", (uintptr_t)mem + offset);
-        unsigned long long ppn =
-            (paddr & ~(~0 << (bit_max - 21 + 1)) << 21) >>
-            21; // keep bits 21 to bit_max+1 from the address
-        if (paddr == 0)
-            if(verbose) {
-                printf(" %llu", i);
-            }
-        rev_map[ppn] = i;
+    if (attempt == LINEAR_ATTEMPTS) {
+        fprintf(stderr, "\nNo linear function matches the slices\n");
+        exit(EXIT_FAILURE);
     }
 
-    // For each bit 21+k -> bit_max
-    for (i = 0; i < bit_max - 21 + 1; i++) {
-        is_candidate = 0; // is there a 2MB page candidate
-        unsigned long long ppn1, ppn2;
+    gf2_solve(&sys, masks, nbits);
 
-        // trying all addresses until finding a pair that is valid
-        for (j = 0; j < mapping_size; j++) {
-            ppn1 = j;               // offset in rev_map
-            ppn2 = ppn1 ^ (1 << i); // offset in rev_map
-            if (rev_map[ppn1] != -1 && rev_map[ppn2] != -1) {
-                is_candidate = 1;
-                break;
+    /*
+     * Print the function in the same format as the other methods
+     */
+    fprintf(stderr, "\n");
+    for (k = 0; k < nbits; k++) {
+        fprintf(stderr, "\no%d =", k);
+        printf("\no%d =", k);
+        for (i = 6; i < 64; i++) {
+            if (masks[k] >> i & 1) {
+                fprintf(stderr, " b%d", i);
+                printf(" b%d", i);
             }
         }
+        fprintf(stderr, "\n");
+        printf("\n");
+    }
 
-        // continue with next bit if there is no valid pair
-        if (is_candidate == 0) {
-            printf("\nNot able to test bit %lld", i + 21);
-            continue;
+    found_masks(masks, nbits, 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#define NONLINEAR_BITS 12      // low line bits of the table: 4096 lines
+#define NONLINEAR_SAMPLES 16   // lines probed per page, more if ambiguous
+#define NONLINEAR_MAX_SAMPLES 128
+
+/*
+ * Measure the slice of n lines of a page, MAX_BATCH at a time
+ */
+static void probe_block(uintptr_t page, const int *lines, int n, int *slices) {
+    uintptr_t addrs[MAX_BATCH];
+    int i, j, batch;
+
+    for (i = 0; i < n; i += batch) {
+        batch = MIN(MAX_BATCH, n - i);
+        for (j = 0; j < batch; j++) {
+            addrs[j] = page + ((uintptr_t)lines[i + j] << 6);
         }
+        probe_lines(addrs, batch, 0, &slices[i]);
+    }
+}
 
-        // Test for several addresses
-        for (j = 0; j < ADDR_PER_BIT; j++) {
-            offset1 = (rev_map[ppn1] << 21) + j;
-            offset2 = (rev_map[ppn2] << 21) + j;
-            if (clflush) {
-                slice1 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset1, 0);
-                slice2 =
-                    monitor_single_address_clflush((uintptr_t)mem + offset2, 0);
-            } else if (class == INTEL_CORE) {
-                slice1 =
-                    monitor_single_address_core((uintptr_t)mem + offset1, 0);
-                slice2 =
-                    monitor_single_address_core((uintptr_t)mem + offset2, 0);
-            } else {
-                slice1 = monitor_single_address((uintptr_t)mem + offset1);
-                slice2 = monitor_single_address((uintptr_t)mem + offset2);
+/*
+ * Find y such that the lines x of the page have the slice of line x ^ y of
+ * the reference block: flipping the high bits that differ between both pages
+ * does to the pre-hash what flipping y does in the low bits. y is unique up
+ * to the invariant differences of the block (in_kernel).
+ */
+static int match_page(uintptr_t page, const int *block, const char *in_kernel,
+                      int *y_out) {
+    int size = 1 << NONLINEAR_BITS;
+    int lines[NONLINEAR_MAX_SAMPLES], slices[NONLINEAR_MAX_SAMPLES];
+    int *matches = (int *)calloc(size, sizeof(int));
+    int n = 0, i, y, best, ambiguous;
+
+    if (matches == NULL) {
+        fprintf(stderr, "Cannot allocate the match table\n");
+        exit(EXIT_FAILURE);
+    }
+    while (n < NONLINEAR_MAX_SAMPLES) {
+        for (i = n; i < n + NONLINEAR_SAMPLES; i++) {
+            lines[i] = random() % size;
+        }
+        probe_block(page, &lines[n], NONLINEAR_SAMPLES, &slices[n]);
+        for (y = 0; y < size; y++) {
+            for (i = n; i < n + NONLINEAR_SAMPLES; i++) {
+                matches[y] += (block[lines[i] ^ y] == slices[i]);
             }
-            // for each address bit i of function bit k
-            for (k = 0; k < nbits; k++) {
-                oj_a1 =
-                    (slice1 >> k) & 1; // bit k of output of slice for address 1
-                oj_a2 = (slice2 >> k) & 1;
-                if (oj_a1 != oj_a2) {
-                    w[k][i + 15]++;
-                }
+        }
+        n += NONLINEAR_SAMPLES;
+
+        best = 0;
+        for (y = 1; y < size; y++) {
+            if (matches[y] > matches[best]) {
+                best = y;
             }
         }
-        if(verbose) {
-            printf("For addr bit %lld: ", i + 6 + 15);
-            for (k = 0; k < nbits; k++) {
-                printf("hash bit %d: %d samples, ", k, w[k][i]);
+        ambiguous = 0;
+        for (y = 0; y < size; y++) {
+            if (matches[y] == matches[best] && !in_kernel[y ^ best]) {
+                ambiguous = 1;
             }
-            printf("\n");
         }
+        // Tolerate one wrong probe in 8
+        if (!ambiguous && matches[best] >= n - n / 8) {
+            free(matches);
+            *y_out = best;
+            return 0;
+        }
+    }
+    free(matches);
+    return -1;
+}
 
-#if DEBUG
-        fprintf(stderr, ".");
-#endif // DEBUG
+/*
+ * Learn the hash as a linear pre-hash and a table (see model.h), which works
+ * whatever the number of slices.
+ *
+ * The slices of the first 2^NONLINEAR_BITS lines of a reference page give the
+ * table for the low bits. For every other page whose physical address differs
+ * from the reference in a new combination D of higher bits, a few probed lines
+ * tell which low-bit difference y_D has the same effect on the pre-hash. The
+ * y_D are linear in D: solving that system over GF(2) gives, for each low
+ * bit, the higher bits that are XORed into it.
+ */
+void reverse_nonlinear(const char *path) {
+    int size = 1 << NONLINEAR_BITS;
+    int i, j, d, y, ret;
+    uint64_t low_mask = (uint64_t)(size - 1) << 6;
+    uint64_t reference, diff, seen = 0, high_masks[NONLINEAR_BITS];
+    gf2_t diffs, effects, trial;
+    model_t model;
+
+    int page_shift;
+    long nb_pages;
+    char *mem = map_widest(&page_shift, &nb_pages);
+    size_t mmap_size = (size_t)nb_pages << page_shift;
+
+    int *block = (int *)malloc(size * sizeof(int));
+    int *lines = (int *)malloc(size * sizeof(int));
+    char *in_kernel = (char *)calloc(size, sizeof(char));
+    if (block == NULL || lines == NULL || in_kernel == NULL ||
+        model_init(&model, socket_ctx->nb_cores, NONLINEAR_BITS) < 0) {
+        fprintf(stderr, "Cannot allocate the reference block\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (monitor_arm() < 0) {
+        exit(EXIT_FAILURE);
+    }
+    srandom(time(NULL));
+
+    /*
+     * Reference block: every line of the low bits
+     */
+    reference = translate((uintptr_t)mem);
+    if (reference == 0) {
+        fprintf(stderr, "Cannot translate addresses (not root?)\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < size; i++) {
+        lines[i] = i;
+    }
+    probe_block((uintptr_t)mem, lines, size, block);
+
+    // Low-bit differences that never change the slice (allowing 1% noise)
+    for (d = 0; d < size; d++) {
+        int changes = 0;
+        for (i = 0; i < size; i++) {
+            changes += (block[i] != block[i ^ d]);
+        }
+        in_kernel[d] = (changes <= size / 100);
+    }
+
+    /*
+     * Higher bits: the bits of the reference page above the block, then
+     * the other pages
+     */
+    gf2_init(&diffs);
+    gf2_init(&effects);
+    for (i = -(page_shift - 6 - NONLINEAR_BITS); i < nb_pages; i++) {
+        uintptr_t page;
+
+        if (i < 0) {
+            page = (uintptr_t)mem + (1UL << (page_shift + i));
+        } else {
+            page = (uintptr_t)mem + ((uintptr_t)i << page_shift);
+        }
+        diff = translate(page) ^ reference;
+        seen |= diff;
+        // Only matched differences are kept: a page that fails leaves its
+        // combination of bits to a later page
+        trial = diffs;
+        if (diff & low_mask || gf2_add(&trial, diff, 0) != GF2_NEW) {
+            continue; // nothing new to learn from this page
+        }
+        if (match_page(page, block, in_kernel, &y) < 0) {
+            fprintf(stderr, "No consistent pre-hash for bits 0x%llx\n",
+                    (unsigned long long)diff);
+            continue;
+        }
+        diffs = trial;
+        gf2_add(&effects, diff, y);
+        if (verbose) {
+            printf("Bits 0x%llx act as low bits 0x%x\n",
+                   (unsigned long long)diff, y << 6);
+        }
     }
 
-    munmap(mem, MMAP_SIZE_CORE);
+    monitor_disarm();
+    unmap_pages(mem, mmap_size);
 
     /*
-     * Look at the tables to find bits that intervene in the function
+     * Pre-hash bit j: low bit 6 + j, XOR the higher bits acting on it. The
+     * table is the reference block, re-indexed by the pre-hash of its lines.
      */
+    gf2_solve(&effects, high_masks, NONLINEAR_BITS);
+    int reference_index = 0;
+    for (j = 0; j < NONLINEAR_BITS; j++) {
+        model.masks[j] = (1ULL << (6 + j)) | high_masks[j];
+        reference_index |= __builtin_parityll(reference & model.masks[j]) << j;
+    }
+    for (i = 0; i < size; i++) {
+        model.table[i ^ reference_index] = block[i];
+    }
+
     fprintf(stderr, "\n");
-    for (j = 0; j < nbits; j++) {
-        fprintf(stderr, "\no%d =", j);
-        printf("\no%d =", j);
-        for (i = 0; i < bit_max; i++) {
-            if (w[j][i] > THRESHOLD) {
-                fprintf(stderr, " b%llu", i + 6);
-                printf(" b%llu", i + 6);
+    for (j = 0; j < NONLINEAR_BITS; j++) {
+        fprintf(stderr, "h%d =", j);
+        printf("h%d =", j);
+        for (i = 6; i < 64; i++) {
+            if (model.masks[j] >> i & 1) {
+                fprintf(stderr, " b%d", i);
+                printf(" b%d", i);
             }
         }
         fprintf(stderr, "\n");
         printf("\n");
     }
+    // Bits that vary in the pool but could not be told apart from others
+    uint64_t unknown = 0;
+    for (i = 6 + NONLINEAR_BITS; seen >> i != 0; i++) {
+        if (!(effects.pivots >> i & 1)) {
+            unknown |= 1ULL << i;
+        }
+    }
+    if (unknown != 0) {
+        fprintf(stderr, "Not able to test bits 0x%llx, assumed unused\n",
+                (unsigned long long)unknown);
+    }
+
+    ret = model_save(&model, path);
+    if (ret < 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "Model written to %s\n", path);
+
+    found_function(&model, 0);
+
+    model_free(&model);
+    free(block);
+    free(lines);
+    free(in_kernel);
 }
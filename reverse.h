@@ -25,4 +25,8 @@ void print_help();
 void reverse_core();
 void reverse_xeon();
 void reverse_generic();
+void reverse_linear();
+void reverse_nonlinear(const char *path);
 void scan_addresses();
+int known_function();
+void reverse_socket();
@@ -23,6 +23,7 @@
 
 #define _GNU_SOURCE
 #include <cpuid.h>
+#include <errno.h>
 #include <getopt.h>
 #include <sched.h>
 #include <stdint.h>
@@ -36,9 +37,12 @@
 #include "arch.h"
 #include "global_variables.h"
 #include "monitoring.h"
+#include "perf_uncore.h"
 #include "poke.h"
 #include "rdmsr.h"
 #include "scan.h"
+#include "sockets.h"
+#include "topology.h"
 #include "util.h"
 #include "wrmsr.h"
 
@@ -46,7 +50,7 @@
 
 void print_help() {
     fprintf(stderr,
-            "  >> Usage: sudo ./scan -c nb_cores -a (sdb|ivb|hsw|core)\n");
+            "  >> Usage: sudo ./scan [-f] [-p] [-v] [-c cpu] [-a margin] [-d] [-b] [-A]\n");
 }
 
 /*
@@ -54,7 +58,7 @@ void print_help() {
  */
 
 int verbose = 0;
-int clflush = 0;
+int all_sockets = 0;
 
 int main(int argc, char **argv) {
 
@@ -66,69 +70,118 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    /*
-     * Pin to core
-     */
-    int cpu_mask = 0;
-    cpu_set_t my_set;
-    CPU_ZERO(&my_set);
-    CPU_SET(cpu_mask, &my_set);
-    sched_setaffinity(0, sizeof(cpu_set_t), &my_set);
-
-    /*
-     * Extract CPU information: micro-arch name and number of cores
-     * https://en.wikichip.org/wiki/intel/cpuid
-     */
-    nb_cores = cores_per_package();
-    int cpu_model = get_cpu_model();
     /*
      * Options
      */
     int opt;
-    while ((opt = getopt(argc, argv, "hfv")) != -1) {
+    int cpu_mask = 0;
+    while ((opt = getopt(argc, argv, "hfvc:pa:dbA")) != -1) {
         switch (opt) {
         case 'h':
             print_help();
             exit(1);
+        case 'c':
+            cpu_mask = atoi(optarg);
+            break;
+        case 'p':
+            monitoring_perf = 1;
+            break;
+        case 'a':
+            adaptive_margin = atof(optarg);
+            break;
+        case 'd':
+            monitoring_delta = 1;
+            break;
+        case 'b':
+            monitoring_batch = 1;
+            break;
         case 'f':
-            clflush = 1;
+            monitoring_clflush = 1;
             break;
         case 'v':
             verbose = 1;
             break;
+        case 'A':
+            all_sockets = 1;
+            break;
         default:
             print_help();
             exit(1);
         }
     }
 
-
-    if (determine_class_uarch(cpu_model) < 0 && !clflush) {
+    /*
+     * Extract CPU information: micro-arch name and number of cores
+     * https://en.wikichip.org/wiki/intel/cpuid
+     */
+    if (topology_init() < 0) {
+        fprintf(stderr, "Cannot read the CPU topology\n");
         exit(EXIT_FAILURE);
     }
+
     /*
-     * Initialize architecture-dependent variables
+     * One context per package scanned: the package of the CPU given with -c,
+     * or all of them, each driven from its first CPU
      */
+    int nb_sockets = all_sockets ? topology_nb_packages() : 1;
+    int i, n = 0;
+    socket_ctx_t *sockets =
+        (socket_ctx_t *)calloc(nb_sockets, sizeof(socket_ctx_t));
 
-    if (setup_perf_counters(class, archi, nb_cores) < 0 && !clflush) {
+    if (sockets == NULL) {
+        fprintf(stderr, "Cannot allocate the socket contexts\n");
         exit(EXIT_FAILURE);
     }
+    for (i = 0; i < nb_sockets; i++) {
+        int cpu = all_sockets ? topology_core_cpu(i, 0) : cpu_mask;
+        socket_ctx_t *ctx = &sockets[n];
+        int ret;
+
+        if (cpu < 0) {
+            continue; // no online CPU in this package
+        }
+        ret = socket_ctx_init(ctx, cpu);
+        if (ret == -ENXIO) {
+            fprintf(stderr, "CPU %d is offline\n", cpu);
+            exit(EXIT_FAILURE);
+        }
+        if (ret < 0 && !monitoring_clflush && !monitoring_perf) {
+            exit(EXIT_FAILURE);
+        }
+        if (monitoring_perf) {
+            // perf needs no MSR table: as many slices as exported boxes
+            ctx->max_slices = perf_uncore_count_boxes();
+        }
 
+        /*
+         * Verify number of cores is coherent with micro-architecture
+         */
+        if (ctx->nb_cores > ctx->max_slices && !monitoring_clflush) {
+            fprintf(
+                    stderr,
+                    "Specified number of cores (%d) incoherent with maximum number of "
+                    "core of specified micro-architecure (%d for %s). \n",
+                    ctx->nb_cores, ctx->max_slices, uarch_names[ctx->archi]);
+            print_help();
+            exit(1);
+        }
+        n++;
+    }
 
-    /*
-     * Verify number of cores is coherent with micro-architecture
-     */
-    if (nb_cores > max_slices) {
-        fprintf(
-                stderr,
-                "Specified number of cores (%d) incoherent with maximum number of "
-                "core of specified micro-architecure (%d for %s). \n",
-                nb_cores, max_slices, uarch_names[archi]);
-        print_help();
-        exit(1);
+    if (sockets_run(sockets, n, scan_socket) != 0) {
+        exit(EXIT_FAILURE);
     }
-    printf("Micro-architecture: %s\n", uarch_names[archi]);
-    printf("Number of cores: %d\n", nb_cores);
+    free(sockets);
+
+    return 0;
+}
+
+/*
+ * Scan a few addresses on the package of socket_ctx
+ */
+void scan_socket() {
+    printf("Micro-architecture: %s\n", uarch_names[socket_ctx->archi]);
+    printf("Number of cores: %d\n", socket_ctx->nb_cores);
 
     /*
      * Allocate and initialize memory for monitoring addresses
@@ -142,7 +195,7 @@ int main(int argc, char **argv) {
     char *mem = (char *)malloc(nb_loops * stride);
     if (mem == NULL) {
         printf("Malloc has failed \n");
-        return -1;
+        exit(EXIT_FAILURE);
     } else {
         printf("[+] Allocated memory\n");
     }
@@ -163,22 +216,27 @@ int main(int argc, char **argv) {
     /*
      * Monitor addresses
      */
-    if (clflush) {
-        for (i = 0; i < nb_loops; i++) {
-            monitor_single_address_clflush((uintptr_t)mem + (i * stride), 1);
+    uintptr_t addrs[MAX_BATCH];
+    probe_result_t res[MAX_BATCH];
+    unsigned long long j, n;
+
+    if (monitor_arm() < 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nb_loops; i += n) {
+        n = MIN((unsigned long long)monitor_batch_size(), nb_loops - i);
+        for (j = 0; j < n; j++) {
+            addrs[j] = (uintptr_t)mem + ((i + j) * stride);
         }
-    } else if (class == INTEL_CORE) {
-        for (i = 0; i < nb_loops; i++) {
-            monitor_single_address_core((uintptr_t)mem + (i * stride), 1);
+        if (monitor_probe_batch(addrs, n, res) < 0) {
+            exit(EXIT_FAILURE);
         }
-    } else {
-        for (i = 0; i < nb_loops; i++) {
-            monitor_single_address_fast((uintptr_t)mem + (i * stride));
+        for (j = 0; j < n; j++) {
+            monitor_print(&res[j]);
         }
     }
+    monitor_disarm();
 
     // munmap(mem, HUGE_PAGE_SIZE);
     free(mem);
-
-    return 0;
 }
@@ -22,3 +22,4 @@
 
 
 void print_help();
+void scan_socket();
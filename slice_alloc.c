@@ -0,0 +1,392 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hugetlb.h"
+#include "model.h"
+#include "slice_alloc.h"
+#include "slice_hash.h"
+#include "topology.h"
+#include "translate.h"
+
+#define LINE_CLASS (SLICE_ALLOC_CLASSES - 1)
+#define INDEX_CHUNK 512 // lines translated and hashed at a time
+#define ARENA_BATCH 16  // objects an arena takes from the pool at a time
+
+/*
+ * Free objects are kept in lists linked through their first word
+ */
+static void push(void **list, void *p) {
+    *(void **)p = *list;
+    *list = p;
+}
+
+static void *pop(void **list) {
+    void *p = *list;
+
+    if (p != NULL) {
+        *list = *(void **)p;
+    }
+    return p;
+}
+
+static int size_class(size_t size) {
+    int c = 0;
+
+    if (size == 0 || size > SLICE_ALLOC_LINE) {
+        return -1;
+    }
+    while ((size_t)8 << c < size) {
+        c++;
+    }
+    return c;
+}
+
+/*
+ * Slice of every line of the memory, from the frames of its pages
+ */
+static int index_lines(slice_pool_t *pool, const model_t *model,
+                       int page_shift) {
+    size_t nb_lines = pool->len / SLICE_ALLOC_LINE, i, k, n;
+    uint64_t paddrs[INDEX_CHUNK];
+    slice_hash_t hash;
+    int ret;
+
+    ret = slice_hash_init(&hash, model->masks, model->nb_bits, model->table);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = translate_map(pool->mem, pool->len, page_shift);
+    if (ret < 0) {
+        slice_hash_free(&hash);
+        return ret;
+    }
+    for (i = 0; i < nb_lines && ret == 0; i += n) {
+        n = nb_lines - i < INDEX_CHUNK ? nb_lines - i : INDEX_CHUNK;
+        for (k = 0; k < n; k++) {
+            paddrs[k] = translate((uintptr_t)pool->mem +
+                                  (i + k) * SLICE_ALLOC_LINE);
+            if (paddrs[k] == 0) {
+                ret = -EPERM; // frames hidden without CAP_SYS_ADMIN
+                break;
+            }
+        }
+        if (ret == 0) {
+            slice_hash_batch(&hash, paddrs, n, &pool->line_slice[i]);
+        }
+    }
+    translate_unmap(pool->mem);
+    slice_hash_free(&hash);
+
+    return ret;
+}
+
+int slice_pool_init(slice_pool_t *pool, const model_t *model, void *mem,
+                    size_t len, int page_shift) {
+    size_t nb_lines = len / SLICE_ALLOC_LINE, i;
+    int ret;
+
+    if (len == 0 || len & ((1UL << page_shift) - 1) ||
+        (uintptr_t)mem & ((1UL << page_shift) - 1)) {
+        return -EINVAL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    ret = pthread_mutex_init(&pool->lock, NULL);
+    if (ret != 0) {
+        return -ret;
+    }
+    pool->mem = (char *)mem;
+    pool->len = len;
+    pool->nb_slices = model->nb_slices;
+    pool->line_slice = (uint8_t *)malloc(nb_lines);
+    pool->slices =
+        (slice_list_t *)calloc(model->nb_slices, sizeof(slice_list_t));
+    if (pool->line_slice == NULL || pool->slices == NULL) {
+        slice_pool_free(pool);
+        return -ENOMEM;
+    }
+
+    // Fault in every page, so that it has a frame to translate
+    for (i = 0; i < len; i += 1UL << page_shift) {
+        ((volatile char *)mem)[i] = 0;
+    }
+    ret = index_lines(pool, model, page_shift);
+    if (ret < 0) {
+        slice_pool_free(pool);
+        return ret;
+    }
+    for (i = 0; i < nb_lines; i++) {
+        pool->slices[pool->line_slice[i]].nb_free++;
+    }
+
+    return 0;
+}
+
+/*
+ * Pool of nb_pages huge pages of 1 << page_shift bytes, mapped for it
+ */
+int slice_pool_map(slice_pool_t *pool, const model_t *model, size_t nb_pages,
+                   int page_shift) {
+    size_t len = nb_pages << page_shift;
+    char *mem = hugetlb_map(nb_pages, page_shift);
+    int ret;
+
+    if (mem == MAP_FAILED) {
+        return -errno;
+    }
+    ret = slice_pool_init(pool, model, mem, len, page_shift);
+    if (ret < 0) {
+        munmap(mem, len);
+        return ret;
+    }
+    pool->mapped = 1;
+    return 0;
+}
+
+void slice_pool_free(slice_pool_t *pool) {
+    pthread_mutex_destroy(&pool->lock);
+    if (pool->mapped) {
+        munmap(pool->mem, pool->len);
+    }
+    free(pool->line_slice);
+    free(pool->slices);
+    memset(pool, 0, sizeof(*pool));
+}
+
+/*
+ * Lines of a slice not handed out, either never used or freed
+ */
+size_t slice_pool_available(slice_pool_t *pool, int slice) {
+    size_t n;
+
+    if (slice < 0 || slice >= pool->nb_slices) {
+        return 0;
+    }
+    pthread_mutex_lock(&pool->lock);
+    n = pool->slices[slice].nb_free;
+    pthread_mutex_unlock(&pool->lock);
+
+    return n;
+}
+
+int slice_of(const slice_pool_t *pool, const void *p) {
+    size_t offset = (const char *)p - pool->mem;
+
+    if (offset >= pool->len) {
+        return -1;
+    }
+    return pool->line_slice[offset / SLICE_ALLOC_LINE];
+}
+
+/*
+ * Allocation and release with the pool locked
+ */
+static void *take_line(slice_pool_t *pool, int slice) {
+    slice_list_t *list = &pool->slices[slice];
+    size_t nb_lines = pool->len / SLICE_ALLOC_LINE;
+    void *line = pop(&list->objs[LINE_CLASS]);
+
+    if (line == NULL) {
+        while (list->cursor < nb_lines &&
+               pool->line_slice[list->cursor] != slice) {
+            list->cursor++;
+        }
+        if (list->cursor == nb_lines) {
+            return NULL;
+        }
+        line = pool->mem + list->cursor++ * SLICE_ALLOC_LINE;
+    }
+    list->nb_free--;
+    return line;
+}
+
+static void *take(slice_pool_t *pool, int slice, int c) {
+    slice_list_t *list = &pool->slices[slice];
+    size_t size = (size_t)8 << c, offset;
+    char *line;
+    void *p;
+
+    if (c == LINE_CLASS) {
+        return take_line(pool, slice);
+    }
+    p = pop(&list->objs[c]);
+    if (p != NULL) {
+        return p;
+    }
+
+    // Carve a new line into objects of this class
+    line = (char *)take_line(pool, slice);
+    if (line == NULL) {
+        return NULL;
+    }
+    for (offset = SLICE_ALLOC_LINE - size; offset > 0; offset -= size) {
+        push(&list->objs[c], line + offset);
+    }
+    return line;
+}
+
+static void give(slice_pool_t *pool, int slice, int c, void *p) {
+    push(&pool->slices[slice].objs[c], p);
+    if (c == LINE_CLASS) {
+        pool->slices[slice].nb_free++;
+    }
+}
+
+void *slice_alloc(slice_pool_t *pool, int slice, size_t size) {
+    int c = size_class(size);
+    void *p;
+
+    if (c < 0 || slice < 0 || slice >= pool->nb_slices) {
+        errno = EINVAL;
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    p = take(pool, slice, c);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (p == NULL) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void slice_free(slice_pool_t *pool, void *p, size_t size) {
+    int c = size_class(size), slice;
+
+    slice = slice_of(pool, p);
+    if (p == NULL || c < 0 || slice < 0) {
+        return; // not an object of this pool
+    }
+    pthread_mutex_lock(&pool->lock);
+    give(pool, slice, c, p);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Slice of the core the calling thread runs on
+ */
+int slice_local_slice(const slice_pool_t *pool) {
+    int cpu, core, ret;
+
+    ret = topology_init();
+    if (ret < 0) {
+        return ret;
+    }
+    cpu = sched_getcpu();
+    if (cpu < 0) {
+        return -errno;
+    }
+    core = topology_cpu_core(cpu);
+    if (core < 0) {
+        return -ENXIO;
+    }
+    return core % pool->nb_slices;
+}
+
+/*
+ * Arena of one slice, or of the slice of the calling core if slice is
+ * negative
+ */
+int slice_arena_init(slice_arena_t *arena, slice_pool_t *pool, int slice) {
+    if (slice < 0) {
+        slice = slice_local_slice(pool);
+        if (slice < 0) {
+            return slice;
+        }
+    }
+    if (slice >= pool->nb_slices) {
+        return -EINVAL;
+    }
+    memset(arena, 0, sizeof(*arena));
+    arena->pool = pool;
+    arena->slice = slice;
+
+    return 0;
+}
+
+void *slice_arena_alloc(slice_arena_t *arena, size_t size) {
+    int c = size_class(size), i;
+    void *p;
+
+    if (c < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    p = pop(&arena->objs[c]);
+    if (p != NULL) {
+        return p;
+    }
+
+    pthread_mutex_lock(&arena->pool->lock);
+    for (i = 0; i < ARENA_BATCH; i++) {
+        p = take(arena->pool, arena->slice, c);
+        if (p == NULL) {
+            break;
+        }
+        push(&arena->objs[c], p);
+    }
+    pthread_mutex_unlock(&arena->pool->lock);
+
+    p = pop(&arena->objs[c]);
+    if (p == NULL) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void slice_arena_free(slice_arena_t *arena, void *p, size_t size) {
+    if (p == NULL || size_class(size) < 0) {
+        return;
+    }
+    // Objects of other slices, allocated by other arenas, go to the pool
+    if (slice_of(arena->pool, p) != arena->slice) {
+        slice_free(arena->pool, p, size);
+        return;
+    }
+    push(&arena->objs[size_class(size)], p);
+}
+
+/*
+ * Give the free objects of an arena back to the pool, before its thread
+ * exits
+ */
+void slice_arena_release(slice_arena_t *arena) {
+    int c;
+    void *p;
+
+    pthread_mutex_lock(&arena->pool->lock);
+    for (c = 0; c < SLICE_ALLOC_CLASSES; c++) {
+        while ((p = pop(&arena->objs[c])) != NULL) {
+            give(arena->pool, arena->slice, c, p);
+        }
+    }
+    pthread_mutex_unlock(&arena->pool->lock);
+}
@@ -0,0 +1,99 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_SLICE_ALLOC_H
+#define SLICE_REVERSE_SLICE_ALLOC_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "model.h"
+
+/*
+ * Slice-aware allocator. A pool takes memory (huge pages, or any page-aligned
+ * mapping that stays resident), sorts its lines by LLC slice once, from their
+ * physical addresses and a slice function (see model.h and registry.h), and
+ * hands out lines of the slice asked for.
+ *
+ * Objects of up to a line are carved from the lines of one slice, in size
+ * classes of 8, 16, 32 and 64 bytes. Larger objects cannot be both contiguous
+ * and in one slice, since the hash uses the low line bits: hot state has to
+ * be split in line-sized pieces.
+ *
+ * The slices are those of the frames the memory holds when the pool is made:
+ * a new pool follows any change of the physical layout.
+ *
+ * A pool is shared by all threads and locked. An arena belongs to one thread
+ * and serves one slice, by default the slice of the core the thread runs on
+ * (slice k is next to core k of the package, as for the clflush method): it
+ * takes objects from the pool in batches and keeps those freed to it, without
+ * locking. Threads using arenas should be pinned.
+ *
+ * Functions returning int return 0 or a negative errno value; allocations
+ * return NULL with errno set, like malloc.
+ */
+
+#define SLICE_ALLOC_LINE 64
+#define SLICE_ALLOC_CLASSES 4 // 8, 16, 32 and 64 bytes
+
+typedef struct {
+    size_t cursor;                     // lines before it are handed out or
+                                       // of other slices
+    size_t nb_free;                    // lines of the slice not handed out
+    void *objs[SLICE_ALLOC_CLASSES];   // free objects of each class
+} slice_list_t;
+
+typedef struct {
+    char *mem;
+    size_t len;
+    int mapped;                        // mem comes from slice_pool_map()
+    int nb_slices;
+    uint8_t *line_slice;               // slice of each line
+    slice_list_t *slices;
+    pthread_mutex_t lock;
+} slice_pool_t;
+
+typedef struct {
+    slice_pool_t *pool;
+    int slice;
+    void *objs[SLICE_ALLOC_CLASSES];
+} slice_arena_t;
+
+int slice_pool_init(slice_pool_t *pool, const model_t *model, void *mem,
+                    size_t len, int page_shift);
+int slice_pool_map(slice_pool_t *pool, const model_t *model, size_t nb_pages,
+                   int page_shift);
+void slice_pool_free(slice_pool_t *pool);
+size_t slice_pool_available(slice_pool_t *pool, int slice);
+int slice_of(const slice_pool_t *pool, const void *p);
+
+void *slice_alloc(slice_pool_t *pool, int slice, size_t size);
+void slice_free(slice_pool_t *pool, void *p, size_t size);
+
+int slice_local_slice(const slice_pool_t *pool);
+int slice_arena_init(slice_arena_t *arena, slice_pool_t *pool, int slice);
+void *slice_arena_alloc(slice_arena_t *arena, size_t size);
+void slice_arena_free(slice_arena_t *arena, void *p, size_t size);
+void slice_arena_release(slice_arena_t *arena);
+
+#endif // SLICE_REVERSE_SLICE_ALLOC_H
@@ -0,0 +1,236 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slice_hash.h"
+
+#define BATCH_CHUNK 512
+
+typedef void (*index_kernel_t)(const uint64_t *, int, const uint64_t *,
+                               size_t, uint32_t *);
+
+static void index_scalar(const uint64_t *masks, int nb_masks,
+                         const uint64_t *paddrs, size_t n, uint32_t *out) {
+    size_t i;
+    int j;
+
+    // One mask at a time over all the addresses: the inner loop has no
+    // dependency between iterations
+    for (i = 0; i < n; i++) {
+        out[i] = 0;
+    }
+    for (j = 0; j < nb_masks; j++) {
+        for (i = 0; i < n; i++) {
+            out[i] |= (uint32_t)__builtin_parityll(paddrs[i] & masks[j]) << j;
+        }
+    }
+}
+
+/*
+ * AVX2 has no 64-bit popcount: the parity of each lane is folded down to
+ * bit 0 with shifts and XORs. Bits are accumulated from the last mask to the
+ * first by doubling, which avoids variable shifts.
+ */
+__attribute__((target("avx2")))
+static void index_avx2(const uint64_t *masks, int nb_masks,
+                       const uint64_t *paddrs, size_t n, uint32_t *out) {
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i low = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+    __m256i m[32];
+    size_t i;
+    int j;
+
+    for (j = 0; j < nb_masks; j++) {
+        m[j] = _mm256_set1_epi64x(masks[j]);
+    }
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i addr = _mm256_loadu_si256((const __m256i *)&paddrs[i]);
+        __m256i acc = _mm256_setzero_si256();
+        for (j = nb_masks - 1; j >= 0; j--) {
+            __m256i x = _mm256_and_si256(addr, m[j]);
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 32));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 16));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 8));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 4));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 2));
+            x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 1));
+            acc = _mm256_add_epi64(acc, acc);
+            acc = _mm256_or_si256(acc, _mm256_and_si256(x, one));
+        }
+        // Low half of each 64-bit lane, packed in the first 128 bits
+        acc = _mm256_permutevar8x32_epi32(acc, low);
+        _mm_storeu_si128((__m128i *)&out[i], _mm256_castsi256_si128(acc));
+    }
+    if (i < n) {
+        index_scalar(masks, nb_masks, &paddrs[i], n - i, &out[i]);
+    }
+}
+
+/*
+ * AVX-512 with VPOPCNTQ: the parity is bit 0 of the population count. The
+ * tail is handled with masked loads and stores.
+ */
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void index_avx512(const uint64_t *masks, int nb_masks,
+                         const uint64_t *paddrs, size_t n, uint32_t *out) {
+    const __m512i one = _mm512_set1_epi64(1);
+    __m512i m[32];
+    size_t i;
+    int j;
+
+    for (j = 0; j < nb_masks; j++) {
+        m[j] = _mm512_set1_epi64(masks[j]);
+    }
+    for (i = 0; i < n; i += 8) {
+        __mmask8 k = n - i >= 8 ? 0xff : (__mmask8)((1u << (n - i)) - 1);
+        __m512i addr = _mm512_maskz_loadu_epi64(k, &paddrs[i]);
+        __m512i acc = _mm512_setzero_si512();
+        for (j = nb_masks - 1; j >= 0; j--) {
+            __m512i x = _mm512_popcnt_epi64(_mm512_and_si512(addr, m[j]));
+            acc = _mm512_add_epi64(acc, acc);
+            acc = _mm512_or_si512(acc, _mm512_and_si512(x, one));
+        }
+        _mm512_mask_cvtepi64_storeu_epi32(&out[i], k, acc);
+    }
+}
+
+static const struct {
+    const char *name;
+    index_kernel_t kernel;
+} kernels[] = {
+    {"avx512", index_avx512},
+    {"avx2", index_avx2},
+    {"scalar", index_scalar},
+};
+
+#define NB_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static int kernel = -1;
+
+static int kernel_supported(int k) {
+    __builtin_cpu_init();
+    if (kernels[k].kernel == index_avx512) {
+        return __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512vpopcntdq");
+    }
+    if (kernels[k].kernel == index_avx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+    return 1;
+}
+
+static index_kernel_t index_kernel(void) {
+    int k;
+
+    if (kernel < 0) {
+        // The kernels are ordered from the fastest, scalar always matches
+        for (k = 0; !kernel_supported(k); k++)
+            ;
+        kernel = k;
+    }
+    return kernels[kernel].kernel;
+}
+
+const char *slice_hash_kernel(void) {
+    index_kernel();
+    return kernels[kernel].name;
+}
+
+int slice_hash_set_kernel(const char *name) {
+    int k;
+
+    for (k = 0; k < NB_KERNELS; k++) {
+        if (strcmp(kernels[k].name, name) == 0) {
+            if (!kernel_supported(k)) {
+                return -ENOTSUP;
+            }
+            kernel = k;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+void slice_hash_index(const uint64_t *masks, int nb_masks,
+                      const uint64_t *paddrs, size_t n, uint32_t *out) {
+    index_kernel()(masks, nb_masks, paddrs, n, out);
+}
+
+int slice_hash_init(slice_hash_t *hash, const uint64_t *masks, int nb_bits,
+                    const uint8_t *table) {
+    size_t size = (size_t)1 << nb_bits;
+    size_t k;
+
+    if (nb_bits < 0 || nb_bits > SLICE_HASH_MAX_BITS) {
+        return -EINVAL;
+    }
+    memset(hash, 0, sizeof(*hash));
+    hash->nb_bits = nb_bits;
+    memcpy(hash->masks, masks, nb_bits * sizeof(uint64_t));
+
+    if (table == NULL) {
+        return 0;
+    }
+    for (k = 0; k < size && (size_t)table[k] == k; k++)
+        ;
+    if (k == size) {
+        return 0;
+    }
+    hash->table = (uint8_t *)malloc(size);
+    if (hash->table == NULL) {
+        return -ENOMEM;
+    }
+    memcpy(hash->table, table, size);
+
+    return 0;
+}
+
+void slice_hash_free(slice_hash_t *hash) {
+    free(hash->table);
+    hash->table = NULL;
+}
+
+void slice_hash_batch(const slice_hash_t *hash, const uint64_t *paddrs,
+                      size_t n, uint8_t *out) {
+    uint32_t index[BATCH_CHUNK];
+    size_t i, k, len;
+
+    for (i = 0; i < n; i += len) {
+        len = n - i < BATCH_CHUNK ? n - i : BATCH_CHUNK;
+        slice_hash_index(hash->masks, hash->nb_bits, &paddrs[i], len, index);
+        if (hash->table == NULL) {
+            for (k = 0; k < len; k++) {
+                out[i + k] = index[k];
+            }
+        } else {
+            for (k = 0; k < len; k++) {
+                out[i + k] = hash->table[index[k]];
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_SLICE_HASH_H
+#define SLICE_REVERSE_SLICE_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLICE_HASH_MAX_BITS 16
+
+/*
+ * Slice hash compiled for bulk evaluation: one 64-bit mask per pre-hash bit,
+ * and the table of model.h for non-linear hashes. The table is dropped when
+ * it is the identity, so that linear hashes skip the lookup.
+ */
+typedef struct {
+    int nb_bits;
+    uint64_t masks[SLICE_HASH_MAX_BITS];
+    uint8_t *table; // 1 << nb_bits entries, NULL for a linear hash
+} slice_hash_t;
+
+int slice_hash_init(slice_hash_t *hash, const uint64_t *masks, int nb_bits,
+                    const uint8_t *table);
+void slice_hash_free(slice_hash_t *hash);
+
+/*
+ * Slices of n addresses: out[i] = table[index of paddrs[i]]
+ */
+void slice_hash_batch(const slice_hash_t *hash, const uint64_t *paddrs,
+                      size_t n, uint8_t *out);
+
+/*
+ * Linear part of the slice hash over many addresses at once:
+ *
+ *   out[i] = sum over j of parity(paddrs[i] & masks[j]) << j
+ *
+ * for nb_masks up to 32.
+ */
+void slice_hash_index(const uint64_t *masks, int nb_masks,
+                      const uint64_t *paddrs, size_t n, uint32_t *out);
+
+/*
+ * Kernels of slice_hash_index(), picked on first use from the best one the
+ * CPU supports: "avx512" (VPOPCNTQ), "avx2" or "scalar".
+ * slice_hash_set_kernel() forces one, and returns -ENOTSUP if the CPU lacks
+ * it or -EINVAL for an unknown name.
+ */
+const char *slice_hash_kernel(void);
+int slice_hash_set_kernel(const char *name);
+
+#endif // SLICE_REVERSE_SLICE_HASH_H
@@ -0,0 +1,137 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sockets.h"
+
+int sockets_pin(int cpu) {
+    cpu_set_t my_set;
+
+    CPU_ZERO(&my_set);
+    CPU_SET(cpu, &my_set);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &my_set) == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+static void copy_output(FILE *from, FILE *to, socket_ctx_t *ctx) {
+    char buf[4096];
+    size_t n;
+
+    fflush(from);
+    rewind(from);
+    fprintf(to, "Socket %d (CPU %d):\n", ctx->package, ctx->cpu);
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+        fwrite(buf, 1, n, to);
+    }
+    fflush(to);
+}
+
+// Child side: run the job on one package with its output in out/err
+static void run_child(socket_ctx_t *ctx, FILE *out, FILE *err,
+                      void (*job)(void)) {
+    if (dup2(fileno(out), STDOUT_FILENO) < 0 ||
+        dup2(fileno(err), STDERR_FILENO) < 0) {
+        _exit(EXIT_FAILURE);
+    }
+    if (sockets_pin(ctx->cpu) < 0) {
+        fprintf(stderr, "Cannot pin to CPU %d\n", ctx->cpu);
+        exit(EXIT_FAILURE);
+    }
+    socket_ctx = ctx;
+    job();
+    exit(EXIT_SUCCESS);
+}
+
+int sockets_run(socket_ctx_t *ctxs, int nb_ctxs, void (*job)(void)) {
+    pid_t *pids;
+    FILE **files;
+    int i, status, failed = 0;
+
+    if (nb_ctxs == 1) {
+        if (sockets_pin(ctxs[0].cpu) < 0) {
+            fprintf(stderr, "Cannot pin to CPU %d\n", ctxs[0].cpu);
+            return 1;
+        }
+        socket_ctx = &ctxs[0];
+        job();
+        return 0;
+    }
+
+    pids = (pid_t *)calloc(nb_ctxs, sizeof(pid_t));
+    files = (FILE **)calloc(2 * nb_ctxs, sizeof(FILE *));
+    if (pids == NULL || files == NULL) {
+        free(pids);
+        free(files);
+        return -ENOMEM;
+    }
+
+    // Nothing buffered may be inherited, or it would be printed twice
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < nb_ctxs; i++) {
+        files[2 * i] = tmpfile();
+        files[2 * i + 1] = tmpfile();
+        if (files[2 * i] == NULL || files[2 * i + 1] == NULL) {
+            failed = -errno;
+            break;
+        }
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            failed = -errno;
+            break;
+        }
+        if (pids[i] == 0) {
+            run_child(&ctxs[i], files[2 * i], files[2 * i + 1], job);
+        }
+    }
+
+    // Wait for every child started, even if starting the others failed
+    for (i = 0; i < nb_ctxs && pids[i] > 0; i++) {
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != EXIT_SUCCESS) {
+            if (failed >= 0) {
+                failed++;
+            }
+        }
+        copy_output(files[2 * i], stdout, &ctxs[i]);
+        copy_output(files[2 * i + 1], stderr, &ctxs[i]);
+    }
+    for (i = 0; i < 2 * nb_ctxs; i++) {
+        if (files[i] != NULL) {
+            fclose(files[i]);
+        }
+    }
+    free(pids);
+    free(files);
+
+    return failed;
+}
@@ -0,0 +1,50 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+#ifndef SLICE_REVERSE_SOCKETS_H
+#define SLICE_REVERSE_SOCKETS_H
+
+#include "arch.h"
+
+/*
+ * Run the same job on several packages at once.
+ *
+ * With a single context the job runs in this process, pinned to the CPU of
+ * the context. Otherwise one child is forked per context: each child pins
+ * itself to the CPU of its package before touching any memory, so that the
+ * pages it faults in come from the node of that package (the default policy
+ * allocates on the node of the faulting CPU), and drives the uncore of its own
+ * package only. The standard output and error of every child are kept in
+ * temporary files and printed one package after the other once all children
+ * have exited, so that each package reports its own function.
+ *
+ * socket_ctx points to the context of the package while the job runs.
+ * Returns the number of packages on which the job failed, or a negative errno
+ * value if the children could not be started.
+ */
+int sockets_run(socket_ctx_t *ctxs, int nb_ctxs, void (*job)(void));
+
+// Pin the calling thread to a CPU
+int sockets_pin(int cpu);
+
+#endif // SLICE_REVERSE_SOCKETS_H
@@ -0,0 +1,280 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "topology.h"
+
+#define CPU_PATH "/sys/devices/system/cpu"
+
+static int nb_cpus = 0;
+static int nb_packages = 0;
+static int max_cores = 0;      // row length of core_first_cpu
+static int nb_apicids = 0;     // length of apic_to_cpu
+static int *cpu_package = NULL;
+static int *cpu_core = NULL;
+static int *package_cores = NULL;
+static int *core_first_cpu = NULL; // [package * max_cores + core]
+static int *apic_to_cpu = NULL;
+
+/*
+ * Read a single integer from a sysfs file, -1 if it does not exist
+ */
+static int read_topology(int cpu, const char *name) {
+    char path[128];
+    int value = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), CPU_PATH "/cpu%d/topology/%s", cpu, name);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    if (fscanf(f, "%d", &value) != 1) {
+        value = -1;
+    }
+    fclose(f);
+
+    return value;
+}
+
+/*
+ * The APIC id of each CPU is not in sysfs: parse /proc/cpuinfo once
+ */
+static int read_apicids(int *cpu_apicid) {
+    char line[256];
+    int cpu = -1, apicid, max_apicid = -1;
+    FILE *f;
+
+    f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return -errno;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "processor : %d", &cpu) == 1) {
+            continue;
+        }
+        if (sscanf(line, "apicid : %d", &apicid) == 1 && cpu >= 0 &&
+            cpu < nb_cpus) {
+            cpu_apicid[cpu] = apicid;
+            max_apicid = apicid > max_apicid ? apicid : max_apicid;
+        }
+    }
+    fclose(f);
+
+    return max_apicid;
+}
+
+int topology_init(void) {
+    int *core_id = NULL, *cpu_apicid = NULL, *first_thread = NULL;
+    int cpu, other, max_apicid, ret = -ENOMEM;
+    long n;
+
+    if (cpu_package != NULL) {
+        return 0;
+    }
+
+    n = sysconf(_SC_NPROCESSORS_CONF);
+    if (n <= 0) {
+        return -EINVAL;
+    }
+    nb_cpus = n;
+
+    cpu_package = (int *)malloc(nb_cpus * sizeof(int));
+    cpu_core = (int *)malloc(nb_cpus * sizeof(int));
+    core_id = (int *)malloc(nb_cpus * sizeof(int));
+    cpu_apicid = (int *)malloc(nb_cpus * sizeof(int));
+    first_thread = (int *)calloc(nb_cpus, sizeof(int));
+    if (cpu_package == NULL || cpu_core == NULL || core_id == NULL ||
+        cpu_apicid == NULL || first_thread == NULL) {
+        goto fail;
+    }
+
+    for (cpu = 0; cpu < nb_cpus; cpu++) {
+        cpu_package[cpu] = read_topology(cpu, "physical_package_id");
+        core_id[cpu] = read_topology(cpu, "core_id");
+        cpu_apicid[cpu] = -1;
+        if (core_id[cpu] < 0) {
+            cpu_package[cpu] = -1; // offline
+        }
+        if (cpu_package[cpu] >= nb_packages) {
+            nb_packages = cpu_package[cpu] + 1;
+        }
+    }
+    if (nb_packages == 0) {
+        ret = -ENOENT;
+        goto fail;
+    }
+
+    /*
+     * Dense core index: rank of the core_id among the distinct core_ids of
+     * the package. Threads of the same core get the same index.
+     */
+    package_cores = (int *)calloc(nb_packages, sizeof(int));
+    if (package_cores == NULL) {
+        goto fail;
+    }
+    // A CPU is the first thread of its core if no lower CPU shares its core
+    for (cpu = 0; cpu < nb_cpus; cpu++) {
+        cpu_core[cpu] = -1;
+        if (cpu_package[cpu] < 0) {
+            continue;
+        }
+        first_thread[cpu] = 1;
+        for (other = 0; other < cpu; other++) {
+            if (cpu_package[other] == cpu_package[cpu] &&
+                core_id[other] == core_id[cpu]) {
+                first_thread[cpu] = 0;
+                break;
+            }
+        }
+        package_cores[cpu_package[cpu]] += first_thread[cpu];
+    }
+    for (cpu = 0; cpu < nb_cpus; cpu++) {
+        int rank = 0;
+
+        if (cpu_package[cpu] < 0) {
+            continue;
+        }
+        for (other = 0; other < nb_cpus; other++) {
+            if (cpu_package[other] == cpu_package[cpu] && first_thread[other] &&
+                core_id[other] < core_id[cpu]) {
+                rank++;
+            }
+        }
+        cpu_core[cpu] = rank;
+        if (rank + 1 > max_cores) {
+            max_cores = rank + 1;
+        }
+    }
+
+    core_first_cpu = (int *)malloc(nb_packages * max_cores * sizeof(int));
+    if (core_first_cpu == NULL) {
+        goto fail;
+    }
+    for (n = 0; n < nb_packages * max_cores; n++) {
+        core_first_cpu[n] = -1;
+    }
+    for (cpu = nb_cpus - 1; cpu >= 0; cpu--) {
+        if (cpu_package[cpu] >= 0) {
+            core_first_cpu[cpu_package[cpu] * max_cores + cpu_core[cpu]] = cpu;
+        }
+    }
+
+    max_apicid = read_apicids(cpu_apicid);
+    if (max_apicid >= 0) {
+        nb_apicids = max_apicid + 1;
+        apic_to_cpu = (int *)malloc(nb_apicids * sizeof(int));
+        if (apic_to_cpu == NULL) {
+            goto fail;
+        }
+        for (n = 0; n < nb_apicids; n++) {
+            apic_to_cpu[n] = -1;
+        }
+        for (cpu = 0; cpu < nb_cpus; cpu++) {
+            if (cpu_apicid[cpu] >= 0) {
+                apic_to_cpu[cpu_apicid[cpu]] = cpu;
+            }
+        }
+    }
+
+    free(core_id);
+    free(cpu_apicid);
+    free(first_thread);
+    return 0;
+
+fail:
+    free(core_id);
+    free(cpu_apicid);
+    free(first_thread);
+    topology_free();
+    return ret;
+}
+
+void topology_free(void) {
+    free(cpu_package);
+    free(cpu_core);
+    free(package_cores);
+    free(core_first_cpu);
+    free(apic_to_cpu);
+    cpu_package = NULL;
+    cpu_core = NULL;
+    package_cores = NULL;
+    core_first_cpu = NULL;
+    apic_to_cpu = NULL;
+    nb_cpus = 0;
+    nb_packages = 0;
+    max_cores = 0;
+    nb_apicids = 0;
+}
+
+int topology_nb_cpus(void) {
+    return nb_cpus;
+}
+
+int topology_nb_packages(void) {
+    return nb_packages;
+}
+
+int topology_nb_cores(int package) {
+    if (package < 0 || package >= nb_packages) {
+        return -1;
+    }
+    return package_cores[package];
+}
+
+int topology_cpu_package(int cpu) {
+    if (cpu < 0 || cpu >= nb_cpus) {
+        return -1;
+    }
+    return cpu_package[cpu];
+}
+
+int topology_cpu_core(int cpu) {
+    if (cpu < 0 || cpu >= nb_cpus) {
+        return -1;
+    }
+    return cpu_core[cpu];
+}
+
+int topology_core_cpu(int package, int core) {
+    if (package < 0 || package >= nb_packages || core < 0 ||
+        core >= max_cores) {
+        return -1;
+    }
+    return core_first_cpu[package * max_cores + core];
+}
+
+int topology_apic_cpu(unsigned long apicid) {
+    if (apicid >= (unsigned long)nb_apicids) {
+        return -1;
+    }
+    return apic_to_cpu[apicid];
+}
+
+int topology_apic_core(unsigned long apicid) {
+    return topology_cpu_core(topology_apic_cpu(apicid));
+}
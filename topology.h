@@ -0,0 +1,49 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_TOPOLOGY_H
+#define SLICE_REVERSE_TOPOLOGY_H
+
+/*
+ * CPU topology, read once from /sys/devices/system/cpu/cpuN/topology (and the
+ * APIC ids from /proc/cpuinfo) by topology_init(), then looked up in O(1).
+ *
+ * Cores are numbered densely inside their package, in increasing core_id
+ * order: core_id values reported by the kernel may have gaps, core indices
+ * go from 0 to topology_nb_cores(package) - 1 and index the CBo counters.
+ *
+ * Lookups return -1 for an unknown or offline CPU.
+ */
+
+int topology_init(void);
+void topology_free(void);
+
+int topology_nb_cpus(void);
+int topology_nb_packages(void);
+int topology_nb_cores(int package);
+int topology_cpu_package(int cpu);
+int topology_cpu_core(int cpu);
+int topology_core_cpu(int package, int core);
+int topology_apic_cpu(unsigned long apicid);
+int topology_apic_core(unsigned long apicid);
+
+#endif // SLICE_REVERSE_TOPOLOGY_H
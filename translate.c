@@ -0,0 +1,261 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "translate.h"
+
+#define PAGEMAP_ENTRY 8
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_PFN(X) ((X) & 0x7FFFFFFFFFFFFFULL)
+
+#define MAX_REGIONS 8
+#define CACHE_SIZE 512 // 4K translations, direct-mapped on the virtual page
+
+typedef struct {
+    uintptr_t start;
+    size_t len;
+    int shift;
+    uint64_t *pfns; // 4K frame of the first byte of each page
+} region_t;
+
+static int pagemap_fd = -1;
+static region_t regions[MAX_REGIONS];
+static int nb_regions = 0;
+static uint64_t cache_vpn[CACHE_SIZE];
+static uint64_t cache_pfn[CACHE_SIZE];
+
+static void flush_cache(void) {
+    memset(cache_vpn, 0xff, sizeof(cache_vpn));
+}
+
+int translate_init(void) {
+    if (pagemap_fd >= 0) {
+        return 0;
+    }
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    if (pagemap_fd < 0) {
+        return -errno;
+    }
+    flush_cache();
+    return 0;
+}
+
+void translate_free(void) {
+    while (nb_regions > 0) {
+        translate_unmap((void *)regions[0].start);
+    }
+    if (pagemap_fd >= 0) {
+        close(pagemap_fd);
+        pagemap_fd = -1;
+    }
+}
+
+static uint64_t entry_pfn(uint64_t entry) {
+    if (!(entry & PAGEMAP_PRESENT) || (entry & PAGEMAP_SWAPPED)) {
+        return 0;
+    }
+    return PAGEMAP_PFN(entry);
+}
+
+/*
+ * Read the pagemap entries of nb consecutive 4K pages starting at vpn
+ */
+static int read_entries(uint64_t vpn, size_t nb, uint64_t *entries) {
+    size_t size = nb * PAGEMAP_ENTRY, done = 0;
+    ssize_t ret;
+    int err;
+
+    if ((err = translate_init()) < 0) {
+        return err;
+    }
+    while (done < size) {
+        ret = pread(pagemap_fd, (char *)entries + done, size - done,
+                    vpn * PAGEMAP_ENTRY + done);
+        if (ret < 0) {
+            return -errno;
+        }
+        if (ret == 0) {
+            return -EIO;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+/*
+ * 4K frame numbers of the pages of [va, va + len), with one pread. Frames are
+ * 0 for pages that are not present. Return the number of pages.
+ */
+int translate_range(uintptr_t va, size_t len, uint64_t *out_pfns) {
+    uint64_t first = va >> TRANSLATE_4K;
+    uint64_t last = (va + len - 1) >> TRANSLATE_4K;
+    size_t i, nb = last - first + 1;
+    int ret;
+
+    if (len == 0) {
+        return 0;
+    }
+    ret = read_entries(first, nb, out_pfns);
+    if (ret < 0) {
+        return ret;
+    }
+    for (i = 0; i < nb; i++) {
+        out_pfns[i] = entry_pfn(out_pfns[i]);
+    }
+    return nb;
+}
+
+static region_t *find_region(uintptr_t start) {
+    int i;
+
+    for (i = 0; i < nb_regions; i++) {
+        if (regions[i].start == start) {
+            return &regions[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Register a mapping of 2M or 1G pages without reading its frames yet: its
+ * addresses translate to 0 until translate_map_pages() reads them
+ */
+int translate_map_lazy(void *va, size_t len, int page_shift) {
+    region_t *r;
+    size_t nb;
+
+    if (nb_regions == MAX_REGIONS) {
+        return -ENOSPC;
+    }
+    r = &regions[nb_regions];
+    r->start = (uintptr_t)va;
+    r->len = len;
+    r->shift = page_shift;
+    nb = (len + (1UL << page_shift) - 1) >> page_shift;
+    r->pfns = (uint64_t *)calloc(nb, sizeof(uint64_t));
+    if (r->pfns == NULL) {
+        return -ENOMEM;
+    }
+    nb_regions++;
+
+    return 0;
+}
+
+/*
+ * Read the frames of pages [first, first + nb) of a registered mapping, once
+ * they have been faulted in
+ */
+int translate_map_pages(void *va, size_t first, size_t nb) {
+    region_t *r = find_region((uintptr_t)va);
+    uint64_t entry;
+    size_t i;
+    int ret;
+
+    if (r == NULL) {
+        return -ENOENT;
+    }
+    for (i = first; i < first + nb && i << r->shift < r->len; i++) {
+        ret = read_entries((r->start + (i << r->shift)) >> TRANSLATE_4K, 1,
+                           &entry);
+        if (ret < 0) {
+            return ret;
+        }
+        r->pfns[i] = entry_pfn(entry);
+    }
+
+    return 0;
+}
+
+/*
+ * Read the frame of every page of a mapping of 2M or 1G pages once
+ */
+int translate_map(void *va, size_t len, int page_shift) {
+    int ret = translate_map_lazy(va, len, page_shift);
+
+    if (ret < 0) {
+        return ret;
+    }
+    ret = translate_map_pages(va, 0, (len + (1UL << page_shift) - 1) >>
+                                         page_shift);
+    if (ret < 0) {
+        translate_unmap(va);
+    }
+
+    return ret;
+}
+
+/*
+ * Forget a registered mapping and the cached 4K translations, before munmap
+ */
+void translate_unmap(void *va) {
+    int i;
+
+    for (i = 0; i < nb_regions; i++) {
+        if (regions[i].start == (uintptr_t)va) {
+            free(regions[i].pfns);
+            regions[i] = regions[--nb_regions];
+            break;
+        }
+    }
+    flush_cache();
+}
+
+uintptr_t translate(uintptr_t va) {
+    uint64_t vpn = va >> TRANSLATE_4K;
+    uint64_t entry, pfn;
+    region_t *r;
+    int i;
+
+    for (i = 0; i < nb_regions; i++) {
+        r = &regions[i];
+        if (va - r->start < r->len) {
+            pfn = r->pfns[(va - r->start) >> r->shift];
+            if (pfn == 0) {
+                return 0;
+            }
+            return (pfn << TRANSLATE_4K) +
+                   ((va - r->start) & ((1UL << r->shift) - 1));
+        }
+    }
+
+    i = vpn % CACHE_SIZE;
+    if (cache_vpn[i] != vpn) {
+        if (read_entries(vpn, 1, &entry) < 0) {
+            return 0;
+        }
+        pfn = entry_pfn(entry);
+        if (pfn == 0) {
+            return 0; // do not cache pages that are not there yet
+        }
+        cache_vpn[i] = vpn;
+        cache_pfn[i] = pfn;
+    }
+    return cache_pfn[i] << TRANSLATE_4K | (va & ((1UL << TRANSLATE_4K) - 1));
+}
@@ -0,0 +1,56 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 2016 Clémentine Maurice
+ *   Copyright 2021 Guillaume Didier
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ *   Boston MA 02110-1301, USA; either version 2 of the License, or
+ *   (at your option) any later version. *
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * ----------------------------------------------------------------------- */
+
+#ifndef SLICE_REVERSE_TRANSLATE_H
+#define SLICE_REVERSE_TRANSLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Virtual to physical translation through /proc/self/pagemap.
+ *
+ * The pagemap file is opened once and read with pread(). Mappings of huge
+ * pages can be registered with translate_map(): the frame of each huge page is
+ * then read once and every address inside is translated without a syscall.
+ * translate_map_lazy() registers a mapping that is still being faulted in,
+ * and translate_map_pages() reads the frames of its pages as they arrive.
+ * Other addresses go through a small cache of 4K translations.
+ *
+ * Physical addresses are 0 when the page is not present, swapped, or the PFNs
+ * are hidden (reading them needs CAP_SYS_ADMIN).
+ */
+
+#define TRANSLATE_4K 12
+#define TRANSLATE_2M 21
+#define TRANSLATE_1G 30
+
+int translate_init(void);
+void translate_free(void);
+uintptr_t translate(uintptr_t va);
+int translate_range(uintptr_t va, size_t len, uint64_t *out_pfns);
+int translate_map(void *va, size_t len, int page_shift);
+int translate_map_lazy(void *va, size_t len, int page_shift);
+int translate_map_pages(void *va, size_t first, size_t nb);
+void translate_unmap(void *va);
+
+#endif // SLICE_REVERSE_TRANSLATE_H
@@ -32,12 +32,11 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "model.h"
+#include "registry.h"
+#include "topology.h"
 #include "util.h"
 
-#define PAGEMAP_ENTRY 8
-#define GET_BIT(X, Y) (X & ((uint64_t)1 << Y)) >> Y
-#define GET_PFN(X) (X & 0x7FFFFFFFFFFFFF)
-
 // For some reason, the values returned by the calibration tool don't work
 // To have meaningful threshold: run with #define DEBUG in monitoring.c
 // to observe the histogram of one address
@@ -91,6 +90,32 @@ int get_cpu_model() { // TODO
     return cpu_model;
 }
 
+/*
+ * CPUID.1:EAX, the family, model and stepping of the CPU
+ */
+unsigned int get_cpu_signature() {
+    unsigned int eax, ebx, ecx, edx;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+
+    return eax;
+}
+
+/*
+ * Width of physical addresses, from CPUID.80000008H:EAX[7:0]
+ */
+int get_phys_address_bits() {
+    unsigned int eax, ebx, ecx, edx;
+
+    __cpuid(0x80000000, eax, ebx, ecx, edx);
+    if (eax < 0x80000008) {
+        return 36; // the width of the first 64-bit CPUs
+    }
+    __cpuid(0x80000008, eax, ebx, ecx, edx);
+
+    return eax & 0xff;
+}
+
 int partition(int a[], int l, int r) {
     int pivot, i, j, t;
     pivot = a[l];
@@ -229,85 +254,94 @@ void longnop() {
                  "nop\nnop\nnop\nnop\nnop\nnop\nnop\nnop\n");
 }
 
-const int __endian_bit = 1;
-#define is_bigendian() ((*(char *)&__endian_bit) == 0)
-
-uintptr_t read_pagemap(char *path_buf, uintptr_t virt_addr) {
-    int i, c, status;
-    uint64_t file_offset;
-    uintptr_t read_val;
-    FILE *f;
+/*
+ * Model loaded with load_cache_slice_model(), used by get_cache_slice()
+ * instead of the built-in function
+ */
+static model_t slice_model;
 
-    f = fopen(path_buf, "rb");
-    if (!f) {
-        printf("Error! Cannot open %s\n", path_buf);
-        return -1;
-    }
+int load_cache_slice_model(const char *path) {
+    model_free(&slice_model);
+    return model_load(&slice_model, path);
+}
 
-    // Shifting by virt-addr-offset number of bytes
-    // and multiplying by the size of an address (the size of an entry in
-    // pagemap file)
-    file_offset = virt_addr / getpagesize() * PAGEMAP_ENTRY;
-    status = fseek(f, file_offset, SEEK_SET);
-    if (status) {
-        perror("Failed to do fseek!");
-        return -1;
-    }
-    errno = 0;
-    read_val = 0;
-    unsigned char c_buf[PAGEMAP_ENTRY];
-    for (i = 0; i < PAGEMAP_ENTRY; i++) {
-        c = getc(f);
-        if (c == EOF) {
-            printf("\nReached end of the file\n");
-            return 0;
-        }
-        if (is_bigendian())
-            c_buf[i] = c;
-        else
-            c_buf[PAGEMAP_ENTRY - i - 1] = c;
-    }
-    for (i = 0; i < PAGEMAP_ENTRY; i++) {
-        read_val = (read_val << 8) + c_buf[i];
+/*
+ * Use the function of the running CPU found in a registry, -ENOENT if it has
+ * none for this number of slices
+ */
+int load_cache_slice_registry(const char *path, int nb_slices) {
+    registry_t registry;
+    const model_t *known;
+    int ret;
+
+    ret = registry_load(&registry, path);
+    if (ret < 0) {
+        return ret;
     }
-    if (GET_BIT(read_val, 63)) {
-        // printf("PFN: 0x%llx\n",(unsigned long long) GET_PFN(read_val));
+    known = registry_find(&registry, get_cpu_signature(), nb_slices);
+    if (known == NULL) {
+        ret = -ENOENT;
     } else {
-        // printf("Page not present\n");
-        return 0;
+        model_free(&slice_model);
+        ret = model_copy(&slice_model, known);
     }
-    if (GET_BIT(read_val, 62)) {
-        printf("Page swapped\n");
-        return 0;
+    registry_free(&registry);
+
+    return ret;
+}
+
+/*
+ * Built-in function of 2 and 4 slices, as the bits of the address that are
+ * XORed into each bit of the slice
+ */
+static const int h0[] = {6,  10, 12, 14, 16, 17, 18, 20, 22, 24,
+                         25, 26, 27, 28, 30, 32, 33, 35, 36};
+static const int h1[] = {7,  11, 13, 15, 17, 19, 20, 21, 22, 23,
+                         24, 26, 28, 29, 31, 33, 34, 35, 37};
+
+static uint64_t bits_mask(const int *bits, int count) {
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        mask |= 1ULL << bits[i];
     }
-    fclose(f);
+    return mask;
+}
 
-    uintptr_t phys_addr;
-    phys_addr = GET_PFN(read_val) << 12 | (virt_addr & 0xFFF);
+int cache_slice_model(model_t *model, int nb_cores) {
+    int nb_bits = nb_cores == 2 ? 1 : 2;
+    int ret, k;
 
-    return phys_addr;
+    ret = model_init(model, 1 << nb_bits, nb_bits);
+    if (ret < 0) {
+        return ret;
+    }
+    model->masks[0] = bits_mask(h0, sizeof(h0) / sizeof(h0[0]));
+    if (nb_bits > 1) {
+        model->masks[1] = bits_mask(h1, sizeof(h1) / sizeof(h1[0]));
+    }
+    for (k = 0; k < 1 << nb_bits; k++) {
+        model->table[k] = k;
+    }
+    return 0;
 }
 
 int get_cache_slice(uint64_t phys_addr, int nb_cores) {
-    static const int h0[] = {6,  10, 12, 14, 16, 17, 18, 20, 22, 24,
-                             25, 26, 27, 28, 30, 32, 33, 35, 36};
-    static const int h1[] = {7,  11, 13, 15, 17, 19, 20, 21, 22, 23,
-                             24, 26, 28, 29, 31, 33, 34, 35, 37};
+    static uint64_t mask0, mask1;
 
-    int count = sizeof(h0) / sizeof(h0[0]);
-    int hash = 0;
-    int i;
-    for (i = 0; i < count; i++) {
-        hash ^= (phys_addr >> h0[i]) & 1;
+    if (slice_model.table != NULL) {
+        return model_eval(&slice_model, phys_addr);
     }
-    if (nb_cores == 2)
-        return hash;
-    count = sizeof(h1) / sizeof(h1[0]);
-    int hash1 = 0;
-    for (i = 0; i < count; i++) {
-        hash1 ^= (phys_addr >> h1[i]) & 1;
+
+    if (mask0 == 0) {
+        mask0 = bits_mask(h0, sizeof(h0) / sizeof(h0[0]));
+        mask1 = bits_mask(h1, sizeof(h1) / sizeof(h1[0]));
     }
-    return hash1 << 1 | hash;
+    if (nb_cores == 2)
+        return __builtin_parityll(phys_addr & mask0);
+    return __builtin_parityll(phys_addr & mask1) << 1 |
+           __builtin_parityll(phys_addr & mask0);
 }
 
 size_t flush_hit(char *addr) {
@@ -319,14 +353,20 @@ size_t flush_hit(char *addr) {
     return delta;
 }
 
-int same_slice(size_t *hit_histogram) {
+/*
+ * Number of flushes that were as fast as from the core of the address slice
+ */
+size_t fast_hits(size_t *hit_histogram) {
     int i;
-    int count = 0;
+    size_t count = 0;
     for (i = 0; i < T_HIT_REMOTE; i++) {
         count += hit_histogram[i];
     }
+    return count;
+}
 
-    if (count > 50)
+int same_slice(size_t *hit_histogram) {
+    if (fast_hits(hit_histogram) > 50)
         return 1;
     return 0;
 }
@@ -360,90 +400,6 @@ unsigned long cores_per_package() {
     return threads_per_package() / threads_per_core();
 }
 
-unsigned long apicid2coreid(unsigned long apicid, int *map_apicid,
-                            int *map_coreid) {
-    int i;
-    int core = -1;
-    for (i = 0; i < threads_per_package(); i++) {
-        if (map_apicid[i] == apicid) {
-            core = map_coreid[i];
-        }
-    }
-    return core;
-}
-
-/*
- * Get the mapping of each "processor" id to core id
- */
-int *mapping_coreid() {
-    int *map_coreid;
-    map_coreid = (int *)calloc(64, sizeof(int));
-
-    FILE *fp;
-    int n = 0;
-    int fail = -1;
-
-    // The command on popen output the core id in the order of
-    // each "processor" (ie processor 0, then 1, etc)
-    fp = popen(
-        "awk -F ': ' '/core id/ {print $2}' /proc/cpuinfo | paste -sd ' '",
-        "r");
-
-    if (fp == NULL) {
-        printf("Failed to run command\n");
-        exit(1);
-    }
-
-    while (!feof(fp)) {
-        fscanf(fp, "%d %n", &map_coreid[n], &fail);
-        if (fail == -1) {
-            printf("Failed to parse result of command\n");
-            exit(1);
-        }
-        n++;
-    }
-
-    pclose(fp);
-
-    return map_coreid;
-}
-
-/*
- * Get the mapping of each "processor" id to apic id (warning: contains gaps)
- */
-int *mapping_apicid() {
-    int *map_apicid;
-    map_apicid = (int *)calloc(64, sizeof(int));
-
-    FILE *fp;
-    int n = 0;
-    int fail = -1;
-
-    // The command on popen output the apic id in the order of
-    // each "processor" (ie processor 0, then 1, etc)
-    fp = popen("awk -F ': ' '/initial apicid/ {print $2}' /proc/cpuinfo | "
-               "paste -sd ' '",
-               "r");
-
-    if (fp == NULL) {
-        printf("Failed to run command\n");
-        exit(1);
-    }
-
-    while (!feof(fp)) {
-        fscanf(fp, "%d %n", &map_apicid[n], &fail);
-        if (fail == -1) {
-            printf("Failed to parse result of command\n");
-            exit(1);
-        }
-        n++;
-    }
-
-    pclose(fp);
-
-    return map_apicid;
-}
-
 unsigned long current_apic(void) {
     // Output registers
     unsigned long eax, ebx, ecx, edx;
@@ -457,9 +413,10 @@ unsigned long current_apic(void) {
     return edx;
 }
 
-unsigned long current_core(void) {
-    int *map_apicid = mapping_apicid();
-    int *map_coreid = mapping_coreid();
-
-    return apicid2coreid(current_apic(), map_apicid, map_coreid);
+/*
+ * Core (dense index in its package) of the CPU we are running on, -1 if the
+ * topology is not initialized
+ */
+int current_core(void) {
+    return topology_apic_core(current_apic());
 }
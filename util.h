@@ -20,6 +20,7 @@
  *
  * ----------------------------------------------------------------------- */
 
+#include "model.h"
 
 #ifndef HIDEMINMAX
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
@@ -31,6 +32,8 @@
 int is_intel();
 int get_cpu_architecture();
 int get_cpu_model();
+unsigned int get_cpu_signature();
+int get_phys_address_bits();
 int partition(int a[], int l, int r);
 void quicksort(int a[], int l, int r);
 void print_cpu();
@@ -46,16 +49,15 @@ void maccess(void *p);
 void flush(void *p);
 void prefetch(void *p);
 void longnop();
-uintptr_t read_pagemap(char *path_buf, uintptr_t virt_addr);
+int load_cache_slice_model(const char *path);
+int load_cache_slice_registry(const char *path, int nb_slices);
+int cache_slice_model(model_t *model, int nb_cores);
 int get_cache_slice(uint64_t phys_addr, int nb_cores);
 size_t flush_hit(char *addr);
+size_t fast_hits(size_t *hit_histogram);
 int same_slice(size_t *hit_histogram);
 unsigned long threads_per_core();
 unsigned long threads_per_package();
 unsigned long cores_per_package();
-unsigned long apicid2coreid(unsigned long apicid, int *map_apicid,
-                            int *map_coreid);
-int *mapping_coreid();
-int *mapping_apicid();
 unsigned long current_apic(void);
-unsigned long current_core(void);
+int current_core(void);